@@ -1,9 +1,16 @@
 ﻿#pragma once
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <imgui/ImGradientHDR.h>
 #include "core/ecs.hpp"
+#include "lib/Ktx.h"
+#include "lib/MaterialCache.h"
 #include "lib/Planet.h"
 #include "lib/PlanetFactory.h"
+#include "lib/SolarSystem.h"
 #include "platform/opengl/mesh_gl.hpp"
 
 namespace bee
@@ -16,13 +23,29 @@ class PlanetGenSystem : public System
 {
 public:
     PlanetGenSystem();
-    ~PlanetGenSystem() override = default;
+    ~PlanetGenSystem() override;
     void Update(float dt) override;
-    void RebuildTerrain(bool keepColors = true);
-    void RebuildClouds(bool keepColor = true);
+
+    // Rebuilds run in the background while the current materials stay on screen. The returned future is ready once
+    // a rebuild including this request has been uploaded.
+    std::shared_future<void> RebuildTerrain(bool keepColors = true);
+    std::shared_future<void> RebuildClouds(bool keepColor = true);
+    // Applies the tessellation of `meshConfig` to the planet and rebuilds its meshes on the rebuild job
+    void RebuildMeshes();
+
+    // Queues a change to the planet, applied on the rebuild thread right before the next rebuild.
+    // A rebuild still running is cancelled, so only the latest state gets generated in full.
+    std::shared_future<void> SubmitEdit(std::function<void(planet::Planet&)> edit);
+
+    // Blocks until all submitted edits are rebuilt and uploaded, for work needing the planet on the main thread
+    void WaitForRebuild();
 
 #ifdef BEE_INSPECTOR
     void Inspect() override;
+#ifdef PLANETGEN_PROFILING
+    // Live stage timings of the last rebuilds, see planet::Profiler
+    void InspectProfiler();
+#endif
 #endif
 
 protected:
@@ -38,8 +61,71 @@ protected:
 
     planet::PlanetFactory* factory = nullptr;
 
-    std::shared_ptr<bee::Mesh> CreateMesh(planet::Mesh& mesh);
-    std::shared_ptr<bee::Material> CreateMaterial(planet::Material& material);
+    // What the inspector edits instead of the planet's own config, which the rebuild job reads and writes.
+    // Changes reach the planet through SubmitEdit(), so the job is its only writer while it runs.
+    planet::MeshConfig meshConfig{};
+
+    // Materials of the configurations generated recently, so revisiting one is only an upload. Used by the planet and
+    // the solar system alike while enabled.
+    std::unique_ptr<planet::MaterialCache> materialCache{};
+    bool isCacheEnabled = true;
+
+    std::shared_ptr<bee::Mesh> CreateMesh(const planet::Mesh& mesh);
+    std::shared_ptr<bee::Material> CreateMaterial(const planet::Material& material);
+    // Re-uploads only the maps flagged in `maps`, see planet::RebuildStage
+    void UpdateMaterial(bee::Material& output, const planet::Material& material, uint32_t maps);
+
+    // Background rebuild, only one runs at a time since the planet itself isn't thread safe.
+    // The job returns false when it was cancelled before finishing.
+    std::future<bool> rebuildJob{};
+    std::atomic<bool> cancelRebuild{false};
+    std::vector<std::function<void(planet::Planet&)>> queuedEdits{};
+    std::vector<std::promise<void>> queuedWaiters{};
+    std::vector<std::promise<void>> runningWaiters{};
+    // Colors to take over from the planet after a preset change, once the job that applied it is uploaded. They move
+    // along with the waiters, so a cancelled job hands them on to the next one instead of picking up stale colors.
+    struct ColorRefresh
+    {
+        bool terrain = false;
+        bool clouds = false;
+    };
+    ColorRefresh queuedRefresh{};
+    ColorRefresh runningRefresh{};
+    // Of the last uploaded rebuild, the planet's own are written by the job
+    planet::HeightfieldStats terrainStats{};
+    planet::HeightfieldStats cloudStats{};
+
+    // Coarse steps of a running rebuild, moved out by the worker since the planet keeps refining its own material.
+    // 0 disables previews and always rebuilds at full resolution.
+    int previewResolution = 256;
+    std::mutex previewMutex;
+    std::shared_ptr<planet::Material> terrainPreview{};
+    std::shared_ptr<planet::Material> cloudPreview{};
+    void UploadPreviews();
+
+    // Collects a finished rebuild, uploads its maps and starts the next one when edits are queued
+    void PollRebuild();
+    void UploadMaterials();
+    void RefreshColors(const ColorRefresh& refresh);
+
+    // Planets queued for the solar system, generated together in the background and exported as they finish
+    std::vector<planet::PlanetRecipe> systemRecipes{};
+    std::future<void> systemJob{};
+    std::atomic<bool> cancelSystem{false};
+    int systemPlanetCount = 0;          // Of the running job, which works on its own copy of the recipes
+    std::atomic<int> systemPlanetsDone{0};
+    std::atomic<int> systemFailures{0};
+    void GenerateSystem();
+
+    // Exports read the planet on their own thread, so rebuilds wait for them and queued edits pile up meanwhile.
+    // The job returns the error to log, empty when it succeeded.
+    std::future<std::string> exportJob{};
+    std::atomic<bool> cancelExport{false};
+    std::atomic<int64_t> exportedTexels{0};
+    int64_t exportTexels = 0;           // 0 for exports without progress, which can't be cancelled either
+    void ExportTiledMaps(int resolution);
+    void ExportKtx2(const planet::KtxOptions& options);
+    void ExportGlb();
 
     // Color picker stuffs
     glm::vec3 cloudColor{1.0f};
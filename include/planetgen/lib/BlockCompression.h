@@ -0,0 +1,39 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace planet
+{
+enum class BlockFormat
+{
+    BC1,    // RGB, 8 bytes per 4x4 block
+    BC3,    // RGBA, BC1 color plus a BC4 alpha block, 16 bytes per block
+    BC4,    // One channel, 8 bytes per block
+    BC5,    // Two channels, two BC4 blocks, 16 bytes per block
+};
+
+// A block compressed map, every face stored as rows of 4x4 blocks, faces one after the other
+struct CompressedImage
+{
+    BlockFormat format = BlockFormat::BC1;
+    int resolution = 0;
+    int faces = 1;
+    std::vector<uint8_t> data{};
+
+    [[nodiscard]] bool IsEmpty() const { return data.empty(); }
+};
+
+inline size_t GetBlockBytes(const BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+inline int GetBlockCount(const int resolution) { return (resolution + 3) / 4; }
+
+// Compresses every face of a square image with `channels` bytes per texel. BC4 reads channel `channel`,
+// BC5 reads `channel` and the one after it. Partial blocks on the edges repeat the last row and column.
+CompressedImage CompressImage(const unsigned char* source, int resolution, int faces, int channels, BlockFormat format,
+                              int channel = 0);
+}
@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace planet
+{
+// Color ramp baked into a fixed number of packed RGBA8 entries (R in the lowest byte),
+// so coloring a texel by its height is a quantize and a gather instead of a palette search.
+struct ColorLUT
+{
+    static constexpr int size = 4096;
+
+    float min = 0.0f;   // Height mapped to the first entry
+    float max = 1.0f;   // Height mapped to the last entry
+    std::vector<uint32_t> texels{};
+
+    [[nodiscard]] int GetIndex(const float height) const
+    {
+        const float t = (height - min) / (max - min) * (float)(size - 1) + 0.5f;
+        return std::clamp((int)t, 0, size - 1);
+    }
+
+    [[nodiscard]] uint32_t Sample(const float height) const { return texels[GetIndex(height)]; }
+
+    static uint32_t Pack(const float r, const float g, const float b, const float a = 1.0f)
+    {
+        const auto channel = [](const float value) { return (uint32_t)(unsigned char)(255.f * std::clamp(value, 0.0f, 1.0f)); };
+        return channel(r) | channel(g) << 8 | channel(b) << 16 | channel(a) << 24;
+    }
+
+    template<typename ColorFunction>
+    void Bake(ColorFunction&& colorByHeight)
+    {
+        texels.resize(size);
+        for (int i = 0; i < size; i++)
+        {
+            const float height = min + (max - min) * ((float)i / (float)(size - 1));
+            const auto color = colorByHeight(height);
+            texels[i] = Pack(color.r, color.g, color.b);
+        }
+    }
+};
+}
@@ -0,0 +1,15 @@
+﻿#pragma once
+
+#include <string>
+
+namespace planet
+{
+class Planet;
+
+// Writes the terrain and cloud layers of a planet into a single binary glTF: one node per layer, each with its mesh and
+// a PBR material holding every map as an embedded PNG. Clouds are skipped when the preset has none.
+// Maps are PNG encoded in parallel, then the mesh and image buffers stream straight from the planet into the file,
+// so besides the planet itself only the encoded PNGs are held in memory.
+// Only equirectangular materials can be exported, the sphere meshes have no UVs for cubemaps.
+bool ExportGlb(const Planet& planet, const std::string& path);
+}
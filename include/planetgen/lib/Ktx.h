@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include <string>
+
+#include "Material.h"
+
+namespace planet
+{
+enum class KtxMap
+{
+    Albedo,             // RGBA8 sRGB, or BC1/BC3 sRGB
+    Normal,             // RG8, or BC5
+    MetallicRoughness,  // R8 roughness, or BC4
+    Emissive,           // RGBA8 sRGB, or BC1 sRGB
+    Height,             // R16, never block compressed and without mips
+};
+
+struct KtxOptions
+{
+    // Stores the block compressed maps instead of the raw ones. Maps the material has no compressed copy of are
+    // compressed while writing, as are all their mip levels.
+    bool isBlockCompressed = false;
+    // Zstandard supercompression of every level, needs a build with PLANETGEN_WITH_ZSTD
+    bool isSupercompressed = false;
+    int zstdLevel = 10;
+};
+
+// Writes one map of a material with its full mip chain into a KTX2 container. Levels come from Material::mips when
+// present and are downsampled here otherwise. Cubemap materials are written as cubemap textures.
+bool WriteKtx2(const Material& material, KtxMap map, const std::string& path, const KtxOptions& options = {});
+// Every map the material has, as `<prefix>_<map>.ktx2`, encoded in parallel
+bool WriteMaterialKtx2(const Material& material, const std::string& prefix, const KtxOptions& options = {});
+
+// Reads a map written by WriteKtx2 straight into the material: level 0 into the map itself, or into
+// Material::compressed for block compressed files, and the other levels into Material::mips. Texels are copied
+// as stored, only supercompressed levels are inflated.
+bool ReadKtx2(const std::string& path, KtxMap map, Material& material);
+// Every `<prefix>_<map>.ktx2` that exists, false when there is no albedo or any file fails to load
+bool ReadMaterialKtx2(const std::string& prefix, Material& material);
+}
@@ -0,0 +1,123 @@
+﻿#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <FastNoise/FastNoise.h>
+#include <glm/glm.hpp>
+
+#include "Material.h"
+#include "Mesh.h"
+
+namespace planet
+{
+class Planet;
+
+struct LodConfig
+{
+    int maxLevel = 12;              // Deepest subdivision of a cube face, at most 24
+    int chunkQuads = 32;            // Quads along each edge of a chunk mesh, rounded up to a power of two
+    int tileResolution = 128;       // Texels along each edge of a chunk's material tile
+    float splitDistance = 2.5f;     // Chunks split while the camera is closer than this many chunk edges
+    size_t cacheBudget = 256ull * 1024 * 1024;  // Bytes of chunks kept, least recently used ones are dropped first
+    int threads = 0;                // Worker threads, 0 picks half the hardware threads
+};
+
+// One node of the quadtree over a cube face: a patch of terrain mesh with its own material tile
+struct LodChunk
+{
+    int face = 0;
+    int level = 0;
+    int x = 0;                      // Position of the node among the 2^level x 2^level nodes of its face
+    int y = 0;
+
+    // Planet space, centered on the planet like Planet::GetTerrainMesh(). The UVs span the chunk's own tile.
+    Mesh mesh{};
+    // Albedo, normal and roughness of the chunk alone, `resolution` texels along each edge
+    Material material{};
+    // Bumped whenever stitching moved the border vertices, so a renderer knows to upload the mesh again
+    uint64_t revision = 0;
+
+    [[nodiscard]] size_t GetBytes() const;
+
+private:
+    friend class LodTerrain;
+    std::vector<glm::vec3> basePositions{};     // Positions before stitching
+    std::array<int, 4> coarser{};               // Levels the neighbour across each edge is coarser by
+    uint64_t lastUsed = 0;
+};
+
+// Quadtree of cube faces around the terrain of a planet. Every frame the chunks close to the camera split into
+// finer ones, each generating its own noise, mesh and material tile from the planet's terrain preset on worker
+// threads. Finished chunks are kept in a least recently used cache, and the borders of chunks next to coarser
+// ones are moved onto the coarser edge so the levels meet without cracks.
+// The planet is only read while generating. Call Clear() before rebuilding or editing it.
+class LodTerrain
+{
+public:
+    explicit LodTerrain(const Planet& planet, const LodConfig& config = {});
+    ~LodTerrain();
+    LodTerrain(const LodTerrain&) = delete;
+    LodTerrain& operator=(const LodTerrain&) = delete;
+
+    // Picks the chunks for a camera in planet space and requests the missing ones. Areas whose chunks aren't done yet
+    // are drawn by a coarser chunk in the meantime. The returned chunks stay valid until the next Update() or Clear().
+    const std::vector<const LodChunk*>& Update(glm::vec3 camera);
+
+    // Drops every chunk, waiting for the ones being generated, so the planet can be changed safely
+    void Clear();
+
+    [[nodiscard]] const LodConfig& GetConfig() const { return config; }
+    [[nodiscard]] size_t GetCachedBytes() const { return cachedBytes; }
+    [[nodiscard]] size_t GetPendingCount() const;
+
+private:
+    struct Request
+    {
+        uint64_t key = 0;
+        int face = 0;
+        int level = 0;
+        int x = 0;
+        int y = 0;
+        float distance = 0.0f;
+    };
+
+    const Planet& planet;
+    LodConfig config;
+    FastNoise::OutputMinMax noiseRange{};
+
+    // Most recently used chunk at the front
+    std::list<std::unique_ptr<LodChunk>> chunks{};
+    std::unordered_map<uint64_t, std::list<std::unique_ptr<LodChunk>>::iterator> chunkIndex{};
+    size_t cachedBytes = 0;
+    uint64_t frame = 0;
+    std::vector<const LodChunk*> selection{};
+
+    // Shared with the workers
+    mutable std::mutex mutex{};
+    std::condition_variable wake{};
+    std::condition_variable idle{};
+    std::vector<Request> requests{};
+    std::vector<uint64_t> inFlight{};
+    std::vector<std::unique_ptr<LodChunk>> completed{};
+    bool isStopping = false;
+    std::vector<std::thread> workers{};
+
+    static uint64_t GetKey(int face, int level, int x, int y);
+
+    // Adds the chunks covering a node to the selection, false when neither the node nor its children can cover it yet
+    bool Select(int face, int level, int x, int y, glm::vec3 camera, std::vector<Request>& missing);
+    // Level of the selected chunk covering a point of the cube's surface, -1 when there is none
+    [[nodiscard]] int GetSelectedLevel(glm::vec3 cubePoint, const std::unordered_map<uint64_t, int>& selected) const;
+    void Stitch(LodChunk& chunk, const std::unordered_map<uint64_t, int>& selected) const;
+    void Evict();
+
+    void Work();
+    [[nodiscard]] std::unique_ptr<LodChunk> Generate(const Request& request) const;
+};
+}
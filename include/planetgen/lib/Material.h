@@ -1,16 +1,88 @@
 ﻿#pragma once
+#include <cmath>
+#include <cstdint>
 #include <vector>
+#include "BlockCompression.h"
 
 namespace planet
 {
+enum class TextureLayout
+{
+    Equirectangular,    // One resolution x resolution image mapped by longitude and latitude
+    Cubemap,            // Six square faces, in +X, -X, +Y, -Y, +Z, -Z order
+};
+
+// Edge of a cubemap face reaching the same texel density as an equirectangular texture of `resolution`
+// along the equator, the sparsest part of the equirectangular layout
+inline int GetCubemapFaceResolution(const int resolution)
+{
+    return (int)std::ceil((float)resolution / 3.14159265f);
+}
+
+// Block compressed copies of the level 0 maps
+struct CompressedMaps
+{
+    CompressedImage albedo{};               // BC1, or BC3 when the alpha carries coverage
+    CompressedImage normal{};               // BC5 of the X and Y channels
+    CompressedImage metallicRoughness{};    // BC4 of the roughness channel
+    CompressedImage emissive{};             // BC1
+};
+
+// Maps are full textures, so a material can only be moved. Whoever needs it elsewhere, like a renderer on another
+// thread, takes it by move or borrows it by reference.
 struct Material
 {
-    int resolution = 256;
-    int channels = 4;
+    Material() = default;
+    Material(Material&&) = default;
+    Material& operator=(Material&&) = default;
+    Material(const Material&) = delete;
+    Material& operator=(const Material&) = delete;
+
+    TextureLayout layout = TextureLayout::Equirectangular;
+    int resolution = 256;   // Edge of the image, or of a single face for cubemaps
+
+    // Bytes per texel of every map. Normals only store X and Y, Z follows from their unit length.
+    // The ORM map only stores roughness, occlusion and metallic are constant.
+    static constexpr int albedoChannels = 4;            // RGBA8
+    static constexpr int emissiveChannels = 4;          // RGBA8
+    static constexpr int normalChannels = 2;            // RG8
+    static constexpr int occlusionChannels = 1;         // R8
+    static constexpr int metallicRoughnessChannels = 1; // R8 roughness
+
     std::vector<unsigned char> albedo{};
     std::vector<unsigned char> emissive{};
     std::vector<unsigned char> normal{};
     std::vector<unsigned char> occlusion{};
     std::vector<unsigned char> metallicRoughness{};
+    std::vector<uint16_t> height{};                     // Optional R16 height in [0, 1]
+
+    // Emissive is the albedo itself, `emissive` stays empty and GetEmissive() returns the albedo instead
+    bool isEmissiveAlbedo = false;
+
+    // Optional CPU mip pyramid, each level half the resolution of the one before it down to 1x1.
+    // mips[0] is the first level below this one, maps missing here are missing in every level.
+    std::vector<Material> mips{};
+
+    // Empty unless the planet compresses its materials
+    CompressedMaps compressed{};
+
+    [[nodiscard]] int GetFaceCount() const { return layout == TextureLayout::Cubemap ? 6 : 1; }
+    [[nodiscard]] size_t GetTexelCount() const { return static_cast<size_t>(resolution) * resolution * GetFaceCount(); }
+
+    // Read emissive through these, it may alias the albedo
+    [[nodiscard]] const std::vector<unsigned char>& GetEmissive() const { return isEmissiveAlbedo ? albedo : emissive; }
+    [[nodiscard]] const CompressedImage& GetCompressedEmissive() const
+    {
+        return isEmissiveAlbedo ? compressed.albedo : compressed.emissive;
+    }
+
+    // RGBA8 copies of the compact maps, for consumers that only take four channels (GL uploads, image export)
+    [[nodiscard]] std::vector<unsigned char> GetNormalRGBA() const;
+    [[nodiscard]] std::vector<unsigned char> GetMetallicRoughnessRGBA() const;
 };
+
+// Expands RG8 normals to RGBA8 with Z = sqrt(1 - x^2 - y^2)
+void ExpandNormals(const unsigned char* normals, size_t texels, unsigned char* output);
+// Expands R8 roughness to an RGBA8 occlusion/roughness/metallic map with no occlusion and no metal
+void ExpandRoughness(const unsigned char* roughness, size_t texels, unsigned char* output);
 }
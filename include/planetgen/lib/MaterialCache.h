@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "Planet.h"
+
+namespace planet
+{
+// 64 bit FNV-1a, used to address cache entries by everything that went into a material
+struct Fnv1a
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    void Add(const void* data, const size_t size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+    void Add(const std::string& value) { Add(value.data(), value.size()); }
+    void Add(const int value) { Add(&value, sizeof(value)); }
+    void Add(const float value) { Add(&value, sizeof(value)); }
+    void Add(const glm::vec3& value) { Add(value.x); Add(value.y); Add(value.z); }
+};
+
+// Read only view of a whole file, memory mapped so reading a cache entry is a page fault instead of a parse
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] bool IsOpen() const { return data != nullptr; }
+    [[nodiscard]] const unsigned char* GetData() const { return data; }
+    [[nodiscard]] size_t GetSize() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Materials on disk, one file per key, named after the key in hex. A file is a fixed header, a table of the maps
+// it holds, then the raw map data, every map starting on a page boundary so a mapped file can be handed to an upload
+// as is. Only the level 0 maps are stored, mips and compressed maps are rebuilt from them.
+// Entries are written to a temporary file first and renamed into place, so processes can share a directory.
+// With a budget, every store evicts the least recently used entries past it. Loads refresh the modification time of
+// their entry, so it orders the entries by their last use.
+class MaterialCache
+{
+public:
+    // Bumped whenever the file layout or the meaning of a key changes, old entries then simply miss
+    static constexpr uint32_t version = 2;
+
+    explicit MaterialCache(std::filesystem::path directory);
+
+    [[nodiscard]] const std::filesystem::path& GetDirectory() const { return directory; }
+    // Upper bound in bytes for the entries in the directory, 0 keeps every entry
+    void SetBudget(const uint64_t bytes) { budget = bytes; }
+    [[nodiscard]] uint64_t GetBudget() const { return budget; }
+    [[nodiscard]] bool Contains(uint64_t key) const;
+
+    // Fills `material` and `stats` from the entry of `key`, false when there is none or it doesn't validate, including
+    // entries whose maps don't match the checksum stored with them
+    bool Load(uint64_t key, Material& material, HeightfieldStats& stats) const;
+    // Writes the level 0 maps of `material`, replacing any entry of the same key, then trims the cache to its budget
+    bool Store(uint64_t key, const Material& material, const HeightfieldStats& stats) const;
+
+    // The raw entry, for readers that upload straight from the mapping. nullptr when there is none.
+    [[nodiscard]] std::unique_ptr<MappedFile> Map(uint64_t key) const;
+
+    // Removes the oldest entries until the rest fit the budget. Entries another process holds open may stay behind.
+    void Trim() const;
+
+private:
+    std::filesystem::path directory;
+    uint64_t budget = 0;
+
+    [[nodiscard]] std::filesystem::path GetPath(uint64_t key) const;
+};
+}
@@ -1,17 +1,28 @@
 ﻿#pragma once
+#include <cstdint>
 #include <vector>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
 namespace planet
 {
+enum class MeshType
+{
+    UV,     // Latitude/longitude sphere, dense at the poles
+    Cube,   // Spherified cube, evenly distributed vertices
+};
+
 struct MeshConfig
 {
+    MeshType type = MeshType::UV;
     float radius = 1.0f;    // Size of the sphere
-    int stacks = 32;        // Minimum of 2, default of 32
-    int sectors = 64;       // Minimum of 3, default of 64
+    int stacks = 32;        // UV only. Minimum of 2, default of 32
+    int sectors = 64;       // UV only. Minimum of 3, default of 64
+    int subdivisions = 32;  // Cube only. Quads along each edge of a cube face, minimum of 1
     bool inverted = false;
     glm::vec3 offset = glm::vec3(0.0f); // Location in world space
+    float displacement = 0.0f;  // Terrain only. Height of the highest land above the water as a fraction of the radius,
+                                // 0 keeps the perfect sphere
 };
 
 struct Mesh
@@ -19,6 +30,6 @@ struct Mesh
     std::vector<glm::vec3> positions{};
     std::vector<glm::vec3> normals{};
     std::vector<glm::vec2> uvs{};
-    std::vector<uint16_t> indices{};
+    std::vector<uint32_t> indices{};
 };
 }
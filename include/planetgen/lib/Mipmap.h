@@ -0,0 +1,21 @@
+﻿#pragma once
+
+namespace planet
+{
+enum class MipFilter
+{
+    Box,        // 2x2 average of every channel
+    Normal,     // Tangent space normals, decoded, averaged and renormalized so they don't shorten at lower levels
+};
+
+// Edge of the next mip level, odd edges round down
+inline int GetMipResolution(const int resolution) { return resolution > 1 ? resolution / 2 : 1; }
+
+// Halves every face of a square image into `output`, which must hold GetMipResolution(resolution)^2 * faces texels.
+// Faces are filtered separately, so cubemap faces never bleed into each other. Odd sizes, like most cubemap faces,
+// fold their last row and column into the last output row and column.
+void Downsample(const unsigned char* source, int resolution, int faces, int channels, unsigned char* output, MipFilter filter);
+// Only output rows [begin, end) of Downsample(), counted across all faces, so one level can be split among threads
+void DownsampleRows(const unsigned char* source, int resolution, int faces, int channels, unsigned char* output,
+                    MipFilter filter, int begin, int end);
+}
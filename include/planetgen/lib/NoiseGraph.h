@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <FastNoise/FastNoise.h>
+#include <glm/glm.hpp>
+
+namespace planet
+{
+// A generator node together with a key describing the node and everything it samples from.
+// Two nodes with the same key always produce the same noise.
+struct NoiseNode
+{
+    FastNoise::SmartNode<> generator{};
+    std::string key{};
+    // Registry nodes are shared for good. Nodes depending on a planet's radius or offset are built for the caller
+    // alone, as is everything sampling from them, so their endless variations don't pile up in the registry.
+    bool isShared = true;
+
+    explicit operator bool() const { return static_cast<bool>(generator); }
+};
+
+// Registry of every FastNoise node built by the presets. Nodes are created once per unique key and never
+// modified afterwards, so identical sub graphs (the DomainScale -> FractalFBm chains for instance) are shared
+// between presets and between every texture instance of a preset. The domain wrappers around a planet's radius and
+// offset are the exception, see NoiseNode::isShared.
+class NoiseGraph
+{
+    static std::mutex nodesMutex;
+    static std::unordered_map<std::string, FastNoise::SmartNode<>> nodes;
+
+public:
+    // ----------------- SOURCES ----------------- //
+    static NoiseNode Simplex();
+    static NoiseNode OpenSimplex2();
+    static NoiseNode Perlin();
+    static NoiseNode Constant(float value);
+    static NoiseNode CellularDistance(float jitterModifier = 1.0f, FastNoise::CellularDistance::ReturnType returnType = FastNoise::CellularDistance::ReturnType::Index0);
+    static NoiseNode CellularLookup(const NoiseNode& lookup, float jitterModifier);
+
+    // ----------------- FRACTALS ----------------- //
+    static NoiseNode FractalFBm(const NoiseNode& source, float gain, float weightedStrength, int octaves, float lacunarity);
+    static NoiseNode FractalRidged(const NoiseNode& source, float gain, float weightedStrength, int octaves, float lacunarity);
+    static NoiseNode FractalPingPong(const NoiseNode& source, float gain, float weightedStrength, float pingPongStrength, int octaves, float lacunarity);
+
+    // ----------------- DOMAIN ----------------- //
+    static NoiseNode DomainScale(const NoiseNode& source, float scale);
+    static NoiseNode DomainAxisScale(const NoiseNode& source, glm::vec3 scale);
+    static NoiseNode DomainOffset(const NoiseNode& source, glm::vec3 offset);
+    static NoiseNode DomainWarpGradient(const NoiseNode& source, float warpAmplitude, float warpFrequency);
+
+    // ----------------- MODIFIERS ----------------- //
+    static NoiseNode Terrace(const NoiseNode& source, float multiplier, float smoothness);
+    static NoiseNode SeedOffset(const NoiseNode& source, int offset);
+    static NoiseNode Max(const NoiseNode& lhs, const NoiseNode& rhs);
+    static NoiseNode MaxSmooth(const NoiseNode& lhs, const NoiseNode& rhs);
+
+    // Number of unique nodes built so far
+    static size_t GetNodeCount();
+
+private:
+    template<typename T, typename Configure>
+    static NoiseNode Get(std::string key, Configure&& configure, const bool isShared = true)
+    {
+        if (!isShared)
+        {
+            const auto node = FastNoise::New<T>();
+            configure(node);
+            return {node, std::move(key), false};
+        }
+
+        std::lock_guard lock(nodesMutex);
+        auto it = nodes.find(key);
+        if (it == nodes.end())
+        {
+            const auto node = FastNoise::New<T>();
+            configure(node);
+            it = nodes.emplace(key, node).first;
+        }
+
+        return {it->second, std::move(key)};
+    }
+};
+}
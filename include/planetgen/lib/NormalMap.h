@@ -0,0 +1,20 @@
+﻿#pragma once
+
+namespace planet
+{
+// Bump strength of the Sobel normals. Texels with a [0, 1] height at or above `threshold` use `land`, the rest `water`.
+// Larger strengths give steeper normals.
+struct NormalStrength
+{
+    float land = 15.0f;
+    float water = 3.0f;
+    float threshold = 0.0f;
+};
+
+// Tangent space normals of one row of a [-1, 1] heightfield, from a 3x3 Sobel filter over the row and its neighbours.
+// Writes RG8 normals, X and Y only, into `output`.
+// With `wrap` the row wraps around horizontally (longitude), otherwise columns -1 and `width` must be readable apron
+// texels. Rows above and below are picked by the caller, which is where pole and face borders are handled.
+void ComputeNormalRow(const float* top, const float* center, const float* bottom, int width, bool wrap,
+                      const NormalStrength& strength, unsigned char* output);
+}
@@ -1,17 +1,69 @@
 ﻿#pragma once
 
+#include <atomic>
+#include <functional>
+#include <future>
 #include <tinygltf/stb_image.h>
 
 #include "Clouds.h"
+#include "ColorLUT.h"
 #include "Material.h"
+#include "Mipmap.h"
 #include "Sphere.h"
 #include "Terrain.h"
-#include "tools/log.hpp"
+#include "TileSink.h"
 
 namespace planet
 {
 class Terrain;
 class Clouds;
+class MaterialCache;
+
+// Stages of rebuilding a layer, as bit flags. Every parameter only marks the stages depending on it as dirty:
+//   noise -> heightfield stats
+//   noise -> albedo / normal / roughness / height -> upload
+//            albedo -> emissive -> upload
+//   noise -> displaced terrain mesh -> upload
+enum RebuildStage : uint32_t
+{
+    StageNoise = 1 << 0,
+    StageStats = 1 << 1,
+    StageAlbedo = 1 << 2,
+    StageNormal = 1 << 3,
+    StageRoughness = 1 << 4,    // Occlusion/roughness/metallic map
+    StageEmissive = 1 << 5,
+    StageUpload = 1 << 6,       // Maps are waiting to be taken by the renderer
+    StageHeight = 1 << 7,       // R16 height map, only kept when enabled, see Planet::SetHeightStored
+    StageMesh = 1 << 8,         // Terrain mesh displaced by the heightfield, see MeshConfig::displacement
+};
+constexpr uint32_t StageMaps = StageAlbedo | StageNormal | StageRoughness | StageEmissive | StageHeight;
+constexpr uint32_t StageAll = StageNoise | StageStats | StageMaps | StageMesh | StageUpload;
+
+enum class Layer
+{
+    Terrain,
+    Clouds,
+};
+
+struct HeightfieldStats
+{
+    float min = 0.0f;
+    float max = 0.0f;
+};
+
+// Raw noise of one layer together with everything that went into generating it
+struct NoiseField
+{
+    std::string preset{};   // Preset type and generator graph
+    int seed = 0;
+    int resolution = 0;
+    TextureLayout layout = TextureLayout::Equirectangular;
+    float radius = 0.0f;
+    glm::vec3 offset{0.0f};
+    std::vector<float> data{};
+
+    [[nodiscard]] size_t GetBytes() const { return data.capacity() * sizeof(float); }
+};
 
 class Planet
 {
@@ -23,36 +75,223 @@ class Planet
     Clouds* clouds = nullptr;
     MeshConfig* config = nullptr;
     float waterLevel = 0.540f;
+    float landNormalStrength = 15.0f;   // Scaled up with the terrain resolution
+    float waterNormalStrength = 3.0f;
+    const std::atomic<bool>* cancelFlag = nullptr;
+    std::function<void(int, const std::function<void(int)>&)> parallelFor{};
+    MaterialCache* materialCache = nullptr;
+    // Cache entries being written in the background. Their futures block until the write is done, so destroying the
+    // planet waits for them.
+    std::vector<std::future<bool>> cacheWrites{};
+    bool isPreviewing = false;  // Progressive preview steps neither read nor fill the material cache
+    bool isMipmapped = false;
+    bool isCompressed = false;
+    bool isHeightStored = false;
+    bool isTerrainDisplaced = false;    // The terrain mesh differs from the plain sphere of the config
+
+    // Last noise of each layer, so shading-only rebuilds (palette, water level, colors) skip noise generation
+    NoiseField terrainNoise{};
+    NoiseField cloudNoise{};
+    size_t noiseCacheBudget = 256ull * 1024 * 1024;
+
+    uint32_t terrainDirty = StageAll;
+    uint32_t cloudDirty = StageAll;
+    uint32_t terrainUploads = 0;
+    uint32_t cloudUploads = 0;
+    HeightfieldStats terrainStats{};
+    HeightfieldStats cloudStats{};
 
 public:
-    Planet(Terrain* terrain, Clouds* clouds, MeshConfig* config);
+    // With a cache, even the first rebuild done here is served from disk when possible. Without `isGenerated` only the
+    // meshes are built, and the maps wait for the first RebuildTerrain() and RebuildClouds().
+    Planet(Terrain* terrain, Clouds* clouds, MeshConfig* config, MaterialCache* cache = nullptr, bool isGenerated = true);
 
     // 1. Planet Mesh
     // 2. Cloud Mesh
-    // Get as `auto [planet, cloud] = GetMeshes()`
-    [[nodiscard]] std::tuple<Mesh, Mesh> GetMeshes() const { return {terrainMesh, cloudMesh}; }
+    // Get as `auto [planet, cloud] = GetMeshes()`, both are references into the planet
+    [[nodiscard]] std::tuple<const Mesh&, const Mesh&> GetMeshes() const { return {terrainMesh, cloudMesh}; }
+    [[nodiscard]] const Mesh& GetTerrainMesh() const { return terrainMesh; }
+    [[nodiscard]] const Mesh& GetCloudMesh() const { return cloudMesh; }
     [[nodiscard]] const Material& GetTerrainMaterial() const { return terrainMaterial; }
-    [[nodiscard]] const Material& GetTerrainMaterial(const std::vector<std::pair<float, glm::vec3>>& colors);
     [[nodiscard]] const Material& GetCloudMaterial() const { return cloudMaterial; }
-    [[nodiscard]] const Material& GetCloudMaterial(glm::vec3 color);
     [[nodiscard]] const std::vector<std::pair<float, glm::vec3>>& GetTerrainColors() const { return terrainColorPalette; }
     [[nodiscard]] const glm::vec3& GetCloudColor() const { return cloudColor; }
+    [[nodiscard]] const HeightfieldStats& GetTerrainStats() const { return terrainStats; }
+    [[nodiscard]] const HeightfieldStats& GetCloudStats() const { return cloudStats; }
+    [[nodiscard]] MeshConfig* GetConfig() const { return config; }
     [[nodiscard]] Terrain* GetTerrain() const { return terrain; }
     [[nodiscard]] Clouds* GetClouds() const { return clouds; }
     [[nodiscard]] float GetWaterLevel() const { return waterLevel; }
-    void SetWaterLevel(float level) { waterLevel = level; }
+    [[nodiscard]] float GetLandNormalStrength() const { return landNormalStrength; }
+    [[nodiscard]] float GetWaterNormalStrength() const { return waterNormalStrength; }
+
+    // Parameters only mark the stages depending on them as dirty, nothing is generated until a rebuild
+    void SetWaterLevel(float level);
+    // Bump strength of the terrain normals above and below the water level
+    void SetNormalStrength(float land, float water);
+    void SetTerrainColors(const std::vector<std::pair<float, glm::vec3>>& colors);
+    void SetCloudColor(glm::vec3 color);
+    // Relief of the terrain mesh, see MeshConfig::displacement. The mesh follows with the next terrain rebuild.
+    void SetDisplacement(float amplitude);
+
+    // For changes made directly on the terrain or clouds, like toggling emissive. A changed seed,
+    // resolution or preset is picked up by the rebuild itself.
+    void MarkDirty(Layer layer, uint32_t stages);
+    [[nodiscard]] uint32_t GetDirtyStages(Layer layer) const { return layer == Layer::Terrain ? terrainDirty : cloudDirty; }
+
+    // Runs the dirty stages of a layer and returns the stages that were executed
+    uint32_t RebuildTerrain();
+    uint32_t RebuildClouds();
+
+    // Rebuilds a layer coarse to fine when its noise has to be regenerated: first at `previewResolution`, then doubling
+    // up to the texture resolution. `onPreview` takes over the material of every step below the final one, so a renderer
+    // can show it right away without a copy. The next step regenerates every map anyway.
+    // Shading-only changes go straight to the final resolution. Returns the stages of the last step.
+    uint32_t RebuildProgressive(Layer layer, int previewResolution, const std::function<void(Material&&)>& onPreview);
+
+    // Rebuilds poll this flag and stop early once it is raised, for rebuilds running on another thread that got
+    // superseded. Interrupted stages stay dirty and are redone by the next rebuild.
+    void SetCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+    [[nodiscard]] bool IsCancelled() const { return cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed); }
+
+    // Runs `body` for every index in [0, count) and returns once all are done. Rebuilds split their maps, mip levels
+    // and displacement into such items and run them as OpenMP loops unless one is set, so a scheduler running many
+    // planets at once, like the pool of a SolarSystem, spreads every planet's work over its own threads instead.
+    using ParallelFor = std::function<void(int count, const std::function<void(int)>& body)>;
+    void SetParallelFor(ParallelFor parallel) { parallelFor = std::move(parallel); }
+
+    // Maps rebuilt since the last call, to be uploaded by the renderer. StageMesh when the layer's mesh changed.
+    uint32_t TakePendingUploads(Layer layer);
+
+    // Keeps a CPU mip pyramid of every map in the materials, see Material::mips
+    void SetMipmapped(bool mipmapped);
+    [[nodiscard]] bool IsMipmapped() const { return isMipmapped; }
+
+    // Adds block compressed copies of the maps to the materials, see Material::compressed
+    void SetCompressed(bool compressed);
+    [[nodiscard]] bool IsCompressed() const { return isCompressed; }
+
+    // Keeps the terrain heightfield as an R16 map in Material::height, for displacement or export
+    void SetHeightStored(bool stored);
+    [[nodiscard]] bool IsHeightStored() const { return isHeightStored; }
+
+    // Rebuilds look their material up on disk first, and store the ones they had to generate from fresh noise.
+    // Nothing is cached while the cache is nullptr, the planet doesn't own it.
+    void SetMaterialCache(MaterialCache* cache) { materialCache = cache; }
+    [[nodiscard]] MaterialCache* GetMaterialCache() const { return materialCache; }
+    // Everything the final maps of a layer depend on: preset, noise graph, seed, resolution, layout, shading parameters
+    [[nodiscard]] uint64_t GetMaterialKey(Layer layer) const;
+
+    // Upper bound in bytes for the noise kept around between rebuilds, cloud noise is dropped first
+    void SetNoiseCacheBudget(size_t bytes);
+    [[nodiscard]] size_t GetNoiseCacheBudget() const { return noiseCacheBudget; }
+    // Takes noise generated outside the planet as the layer's noise, so the next rebuild only shades it. It has to be
+    // what the layer's texture generates for its current settings, GetNoiseData() with the config's offset.
+    void SetNoiseField(Layer layer, std::vector<float>&& noise);
 
     void SetTerrain(Terrain* inTerrain);
     void SetClouds(Clouds* inClouds);
     // void SetConfig(MeshConfig* inConfig);
 
+    // Regenerates both meshes after the mesh type or tessellation in the config changed. A displaced terrain is
+    // only displaced again by the next terrain rebuild, until then it is the plain sphere.
+    void RebuildMeshes();
+
+    // Generates the maps of a layer tile by tile straight into `sink`, so peak memory depends on the tile size instead
+    // of the resolution. Always equirectangular and at `resolution`, independent of the texture settings.
+    // Leaves the layer's material and cached noise untouched. Layers without noise write nothing.
+    // Returns false when the cancel flag stopped it, after ending the sink with the tiles written so far.
+    bool GenerateTiled(Layer layer, int resolution, TileSink& sink, int tileSize = 1024);
+
+    // Shades the albedo, normal and roughness of a width x height tile from its noise, which carries a one texel apron
+    // on every side. Only reads the planet's shading parameters, so tiles can be shaded on any thread while the planet
+    // isn't being edited. `detail` scales the land normal strength like the texture resolution does.
+    void ShadeTile(Layer layer, const std::vector<float>& noise, int width, int height, float detail, uint32_t stages,
+                   Material& tile) const;
+    // Offset of the terrain surface from the radius at a noise value, see MeshConfig::displacement
+    [[nodiscard]] float GetElevation(float noise) const;
+
 protected:
-    void GenerateTerrainMaterial();
-    void GenerateCloudsMaterial();
+    void GenerateTerrainMaterial(uint32_t stages);
+    void GenerateCloudsMaterial(uint32_t stages);
+
+    // The parallel loop of every rebuild stage, see SetParallelFor()
+    void ForEach(int count, const std::function<void(int)>& body) const;
+
+    // Adds every stage downstream of the given ones
+    static uint32_t GetDependentStages(uint32_t stages);
+
+    // How the rows of a layer's noise are laid out, so the shading kernels can run over either texture layout
+    struct NoiseLayout
+    {
+        int width = 0;          // Size of an output face
+        int height = 0;
+        int faces = 1;
+        int stride = 0;         // Floats per noise row
+        bool wrap = true;       // Equirectangular rows wrap around, cubemap faces and tiles read their apron instead
+
+        // Row y of a face. Rows -1 and height, and columns -1 and width are valid neighbours.
+        [[nodiscard]] const float* GetRow(const std::vector<float>& noise, int face, int y) const;
+        // Bilinear noise at a texture coordinate of the meshes, cubemaps are looked up by direction
+        [[nodiscard]] float Sample(const std::vector<float>& noise, glm::vec2 uv) const;
+    };
+    static NoiseLayout GetNoiseLayout(const Texture* texture);
+
+    // Start of one output row in every map, nullptr for maps the stages don't write
+    struct MapRows
+    {
+        unsigned char* albedo = nullptr;
+        unsigned char* normal = nullptr;
+        unsigned char* metallicRoughness = nullptr;
+        uint16_t* height = nullptr;
+    };
+    // `texel` is the index of the first texel of the row, every map advances by its own texel size
+    static MapRows GetMapRows(Material& material, size_t texel, uint32_t stages);
+    // Bytes per texel of all maps in `stages` together
+    static size_t GetTexelBytes(uint32_t stages);
+
+    // Rebuilds the mip levels of the maps in `stages`, or drops the pyramid when mipmapping is off
+    void BuildMips(Material& material, uint32_t stages) const;
+    // Compresses the maps in `stages`, or drops the compressed maps when compression is off
+    void CompressMaps(Material& material, uint32_t stages, BlockFormat albedoFormat) const;
+    // Pushes the terrain vertices out by the kept noise and recalculates their normals. Without kept noise, a current
+    // material displaces by its height map instead, so a cache hit never generates noise for the mesh.
+    void DisplaceTerrainMesh(bool isMaterialCurrent);
+    // Displaced terrain keeps its height map even when it isn't stored for export, so cache entries carry it
+    [[nodiscard]] bool IsHeightKept() const { return isHeightStored || config->displacement > 0.0f; }
+    // The height map of the terrain material as noise values, laid out like the terrain noise. Cubemap aprons repeat
+    // the border of their face.
+    [[nodiscard]] std::vector<float> GetHeightNoise() const;
+
+    // Shade a single row from its noise and the rows above and below it. `detail` scales the land normal strength.
+    void ShadeTerrainRow(const float* top, const float* center, const float* bottom, int width, bool wrap, float detail,
+                         uint32_t stages, const MapRows& output) const;
+    void ShadeCloudRow(const float* top, const float* center, const float* bottom, int width, bool wrap,
+                       uint32_t stages, const MapRows& output) const;
+
+    [[nodiscard]] bool IsNoiseCurrent(Texture* texture, const NoiseField& field) const;
+    // The layer's noise, generated into the planet's own field when it is missing or stale. Writes the planet and the
+    // texture, so it is only called by rebuilds, never on a planet shared with other threads.
+    const std::vector<float>& GetNoiseField(Texture* texture, NoiseField& field);
+    // Records the texture settings the field's data was generated with
+    void StampNoiseField(Texture* texture, NoiseField& field);
+    static HeightfieldStats CalculateStats(const std::vector<float>& noise);
+    void TrimNoiseCache();
+
+    // Replaces a layer's material and stats with its cache entry and finishes the rebuild, false on a miss
+    bool LoadCachedMaterial(Layer layer);
+    // Writes a copy of the layer's maps on another thread, so the rebuild goes on to its upload right away
+    void StoreCachedMaterial(Layer layer);
 
     glm::vec3 cloudColor{1.0f};
     std::vector<std::pair<float, glm::vec3>> terrainColorPalette{};
 
+    // Baked from the palette and cloud color, refreshed whenever either of them changes
+    ColorLUT terrainColorLUT{};
+    ColorLUT cloudColorLUT{};
+    void BakeTerrainColors();
+    void BakeCloudColors();
+
     glm::vec3 LerpColor(glm::vec3 a, glm::vec3 b, float t);
     glm::vec3 GetColorByHeight(float height);
     glm::vec3 GetCloudColorByHeight(float height);
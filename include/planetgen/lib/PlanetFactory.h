@@ -1,5 +1,7 @@
 ﻿#pragma once
 #include <memory>
+#include <string>
+#include <unordered_map>
 
 #include "Clouds.h"
 #include "Terrain.h"
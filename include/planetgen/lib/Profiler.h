@@ -0,0 +1,88 @@
+﻿#pragma once
+
+// Scoped timing of the generation stages. Define PLANETGEN_PROFILING to enable it, otherwise every
+// PLANET_PROFILE_ macro compiles to nothing and the profiler classes don't exist.
+//
+//     PLANET_PROFILE_SCOPE("Terrain/Maps");
+//     PLANET_PROFILE_SCOPE_BYTES("Sphere/Coordinates", bytes);
+
+#ifdef PLANETGEN_PROFILING
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace planet
+{
+struct ProfileEvent
+{
+    const char* name = nullptr;     // Must outlive the profiler, string literals only
+    int64_t start = 0;              // Microseconds since the profiler started
+    int64_t duration = 0;
+    int threads = 1;                // OpenMP threads available to the scope
+    size_t bytes = 0;               // Bytes the scope allocated or moved, as reported by the scope
+    uint32_t thread = 0;
+};
+
+// Running totals of every scope sharing a name
+struct ProfileStats
+{
+    std::string name{};
+    int64_t calls = 0;
+    double lastMs = 0.0;
+    double totalMs = 0.0;
+    int threads = 1;
+    size_t lastBytes = 0;
+};
+
+class Profiler
+{
+public:
+    static void Record(const ProfileEvent& event);
+
+    // Totals per scope name, sorted by name
+    static std::vector<ProfileStats> GetStats();
+    static void Clear();
+
+    // Writes the recorded events in the Chrome trace event format, for chrome://tracing or Perfetto
+    static bool WriteChromeTrace(const std::string& path);
+
+    static int64_t GetMicroseconds();
+
+    // Only the first events are kept for the trace, the totals keep counting
+    static constexpr size_t maxEvents = 1 << 20;
+
+private:
+    static std::mutex mutex;
+    static std::vector<ProfileEvent> events;
+    static std::vector<ProfileStats> stats;
+};
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name, size_t bytes = 0);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfileEvent event{};
+};
+}
+
+#define PLANET_PROFILE_CONCAT_IMPL(a, b) a##b
+#define PLANET_PROFILE_CONCAT(a, b) PLANET_PROFILE_CONCAT_IMPL(a, b)
+#define PLANET_PROFILE_SCOPE(name) const ::planet::ProfileScope PLANET_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PLANET_PROFILE_SCOPE_BYTES(name, bytes) \
+    const ::planet::ProfileScope PLANET_PROFILE_CONCAT(profileScope, __LINE__)(name, bytes)
+
+#else
+
+#define PLANET_PROFILE_SCOPE(name) ((void)0)
+#define PLANET_PROFILE_SCOPE_BYTES(name, bytes) ((void)0)
+
+#endif
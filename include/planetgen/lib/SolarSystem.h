@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Planet.h"
+#include "PlanetFactory.h"
+#include "WorkStealingPool.h"
+
+namespace planet
+{
+class MaterialCache;
+
+// Everything one planet of a system is generated from
+struct PlanetRecipe
+{
+    std::string terrain = "Gaia";
+    std::string clouds = "None";
+    int seed = 1337;
+    int resolution = 1024;
+    TextureLayout layout = TextureLayout::Equirectangular;
+    MeshConfig mesh{};
+};
+
+// A planet of the system together with the presets and config it points to, which the planet doesn't own
+struct SystemPlanet
+{
+    PlanetRecipe recipe{};
+    std::unique_ptr<Terrain> terrain{};
+    std::unique_ptr<Clouds> clouds{};
+    std::unique_ptr<MeshConfig> config{};
+    std::unique_ptr<Planet> planet{};   // nullptr until generated
+};
+
+// Generates the planets of a system together on one work-stealing pool. The noise of every layer is split into bands
+// of samples that run as separate tasks, so the workers a big planet can't keep busy anymore steal the bands of the
+// others. The last band of a planet goes on to shade it, with its row blocks, mip levels, compressed maps and
+// displacement running as pool tasks too, see Planet::SetParallelFor().
+class SolarSystem
+{
+public:
+    // Called on the worker that finished a planet, right when it's done. Planets finish in any order.
+    using ReadyCallback = std::function<void(size_t index, SystemPlanet& planet)>;
+
+    // With a cache, layers it has a material for skip their noise entirely
+    explicit SolarSystem(PlanetFactory& factory, MaterialCache* cache = nullptr);
+
+    // Instantiates the presets of a recipe, false when either of them is unknown
+    bool Add(const PlanetRecipe& recipe);
+    void Clear() { planets.clear(); }
+
+    // Generates every planet added since the last call and blocks until all of them are done
+    void Generate(WorkStealingPool& pool, const ReadyCallback& onReady = {});
+
+    // Generate() polls this flag and drops the remaining work once it is raised. Planets cancelled midway never reach
+    // the callback and stay incomplete.
+    void SetCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+    [[nodiscard]] bool IsCancelled() const { return cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed); }
+
+    [[nodiscard]] size_t GetPlanetCount() const { return planets.size(); }
+    [[nodiscard]] SystemPlanet& GetPlanet(const size_t index) { return *planets[index]; }
+
+private:
+    struct LayerNoise;
+    struct Job;
+
+    PlanetFactory& factory;
+    MaterialCache* cache = nullptr;
+    const std::atomic<bool>* cancelFlag = nullptr;
+    std::vector<std::unique_ptr<SystemPlanet>> planets{};
+
+    // Creates the planet and submits the noise bands of its layers
+    void Start(WorkStealingPool& pool, const std::shared_ptr<Job>& job, const ReadyCallback& onReady) const;
+    // The last band of a layer normalizes the layer's noise and hands it to the planet
+    void GenerateBand(const std::shared_ptr<Job>& job, int layer, size_t band, const ReadyCallback& onReady) const;
+    void Shade(Job& job, const ReadyCallback& onReady) const;
+};
+}
@@ -1,10 +1,13 @@
 ﻿#pragma once
 
-#include <unordered_map>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <glm/glm.hpp>
+#include "Material.h"
 #include "Mesh.h"
-#include "tools/tools.hpp"
 
 namespace planet
 {
@@ -20,18 +23,66 @@ struct SphericalCoordinates
         y.resize(size);
         z.resize(size);
     }
+
+    [[nodiscard]] size_t GetBytes() const { return (x.size() + y.size() + z.size()) * sizeof(float); }
 };
 
+// Coordinates are immutable once built, so every texture of the same resolution shares one copy
+using SharedSphericalCoordinates = std::shared_ptr<const SphericalCoordinates>;
+
 class Sphere
 {
-    // Resolution as the key (int)
-    static std::unordered_map<int, SphericalCoordinates> coords;
+    struct CacheEntry
+    {
+        int resolution = 0;
+        TextureLayout layout = TextureLayout::Equirectangular;
+        size_t bytes = 0;
+        std::shared_future<SharedSphericalCoordinates> coordinates{};
+    };
+
+    // Most recently used resolution at the front
+    static std::list<CacheEntry> coords;
+    static std::mutex coordsMutex;
+    static size_t coordsBudget;
 
 public:
+    // Mesh of the type selected in the config, grown by `radiusOffset` (used for the cloud layer)
+    static Mesh Create(const MeshConfig& config, float radiusOffset = 0.0f);
     static Mesh UV(float radius = 1.0f, int stacks = 16, int sectors = 32, bool inverted = false);
-    static SphericalCoordinates GetSphericalCoordinates(float radius = 1.0f, int resolution = 256, glm::vec3 offset = glm::vec3(0.0f));
+    static Mesh Cube(float radius = 1.0f, int subdivisions = 32, bool inverted = false);
+
+    // Point on the surface of the [-1, 1] cube at face coordinates s, t of one of the six faces of Cube()
+    static glm::vec3 GetCubePoint(int face, float s, float t);
+    // The face a point is projected onto from the center, with its face coordinates
+    static int GetCubeFace(glm::vec3 point, float& s, float& t);
+    // Moves a point of the cube's surface onto the unit sphere, the mapping Cube() places its vertices with
+    static glm::vec3 Spherify(glm::vec3 point);
+
+    // Index of the first vertex at the same position, for every vertex. Seams and poles duplicate vertices so their UVs
+    // don't interpolate across the texture, displacement and normals have to treat the copies as one vertex.
+    static std::vector<uint32_t> GetSharedVertices(const Mesh& mesh);
+    // Smooth normals from the area weighted normals of the triangles around each vertex, facing along the winding.
+    // Copies of a vertex, see GetSharedVertices, all get the normal of the vertex as a whole.
+    static void CalculateNormals(Mesh& mesh, const std::vector<uint32_t>& shared);
+
+    // Unit sphere coordinates of every texel in the given layout. Scaling by radius and offset is left to the noise domain.
+    // Equirectangular grids hold resolution x resolution texels. Cubemaps hold six faces of (resolution + 2)^2 texels,
+    // the face plus a one texel apron sampled from the neighbouring faces, so filters never need to cross faces.
+    static SharedSphericalCoordinates GetSphericalCoordinates(int resolution = 256, TextureLayout layout = TextureLayout::Equirectangular);
+    static size_t GetSampleCount(int resolution, TextureLayout layout);
+
+    // Uncached coordinates of a rectangle of an equirectangular texture. Texels outside the texture wrap around,
+    // so a tile can include the neighbours its filters need.
+    static SphericalCoordinates GetTileCoordinates(int resolution, int x, int y, int width, int height);
+
+    // Least recently used resolutions are dropped once the cache grows past this many bytes.
+    // Textures still holding on to an evicted entry keep it alive until they are done with it.
+    static void SetCoordinateCacheBudget(size_t bytes);
+    static size_t GetCoordinateCacheBudget() { return coordsBudget; }
 
 private:
-    static void CalculateSphericalCoordinates(int resolution);
+    static SharedSphericalCoordinates CalculateSphericalCoordinates(int resolution);
+    static SharedSphericalCoordinates CalculateCubemapCoordinates(int faceResolution);
+    static void EvictCoordinates();
 };
 }
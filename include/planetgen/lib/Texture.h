@@ -3,21 +3,48 @@
 #include <FastNoise/FastNoise.h>
 #include <vector>
 #include <glm/glm.hpp>
+#include "planetgen/lib/NoiseGraph.h"
+#include "planetgen/lib/Profiler.h"
 #include "planetgen/lib/Sphere.h"
 
 namespace planet
 {
-struct SphericalCoordinates;
-
 class Texture
 {
     friend class Planet;
+    friend class LodTerrain;
+    friend class SolarSystem;
     
 public:
     Texture() = default;
     virtual ~Texture() = default;
 
-    virtual std::vector<float> GetNoiseData(glm::vec3 offset) = 0;
+    virtual std::vector<float> GetNoiseData(glm::vec3 offset)
+    {
+        PrepareNoise(offset);
+        std::vector<float> output(GetSampleCount());
+        const auto range = GenerateOnSphere(output.data());
+        NormalizeNoise(output.data(), output.size(), range);
+        return output;
+    }
+
+    // Noise at an arbitrary set of unit sphere points, used by tiled generation. `range` is the raw noise range
+    // over the whole sphere, which only presets using it to normalize their noise need (see UsesNoiseRange()).
+    // Returns false for layers without any noise.
+    virtual bool GetNoiseTile(glm::vec3 offset, const SphericalCoordinates& coords, float* output,
+                              const FastNoise::OutputMinMax& range)
+    {
+        PrepareNoise(offset);
+        GenerateOnPoints(coords, output);
+        NormalizeNoise(output, coords.x.size(), range);
+        return true;
+    }
+
+    virtual bool UsesNoiseRange() const { return false; }
+    virtual bool HasNoise() const { return true; }
+
+    // Key of the preset's generator graph, identical for presets producing identical noise
+    const std::string& GetGeneratorKey() { return GetGenerator().key; }
 
     int GetSeed() const { return seed; }
     void SetSeed(const int newSeed) { seed = newSeed; }
@@ -25,22 +52,85 @@ public:
     int GetTextureResolution() const { return resolution; }
     void SetTextureResolution(const int newResolution) { resolution = newResolution; }
 
+    // Cubemaps keep the texel density of the equirectangular resolution, see GetCubemapFaceResolution()
+    TextureLayout GetLayout() const { return layout; }
+    void SetLayout(const TextureLayout newLayout) { layout = newLayout; }
+
+    // Edge of the sampled image, or of a single cubemap face without its apron
+    int GetSampleResolution() const
+    {
+        return layout == TextureLayout::Cubemap ? GetCubemapFaceResolution(resolution) : resolution;
+    }
+
+    size_t GetSampleCount() const { return Sphere::GetSampleCount(GetSampleResolution(), layout); }
+
     bool IsEmissive() const { return emissive; }
     void SetEmissive(bool isEmissive) { emissive = isEmissive; }
 
 protected:
     int seed = 1337;
     int resolution = 1024;
+    TextureLayout layout = TextureLayout::Equirectangular;
     bool emissive = false;
 
 private:
     float radius = 1.0f;
     glm::vec3 offset{0.0f};
 
+private:
+    NoiseNode generator{};
+    bool isGeneratorDirty = true;
+
 protected:
-    [[nodiscard]] SphericalCoordinates GetSphericalCoordinates() const
+    // Builds the generator graph of the preset. Only called the first time noise is generated,
+    // and again after InvalidateGenerator() when one of the graph parameters changed.
+    virtual NoiseNode BuildGenerator() = 0;
+
+    void InvalidateGenerator() { isGeneratorDirty = true; }
+
+    const NoiseNode& GetGenerator()
+    {
+        if (isGeneratorDirty)
+        {
+            generator = BuildGenerator();
+            isGeneratorDirty = false;
+        }
+
+        return generator;
+    }
+
+    // Called with the planet's offset before generating any noise, for presets whose graph depends on it
+    virtual void PrepareNoise([[maybe_unused]] glm::vec3 offset) {}
+
+    // Rescales the raw noise in place, `range` being the raw noise range over the whole sphere
+    virtual void NormalizeNoise([[maybe_unused]] float* data, [[maybe_unused]] size_t size,
+                                [[maybe_unused]] const FastNoise::OutputMinMax& range) {}
+
+    // Samples the generator at every texel of the texture
+    FastNoise::OutputMinMax GenerateOnSphere(float* output)
+    {
+        return GenerateOnPoints(*Sphere::GetSphericalCoordinates(GetSampleResolution(), layout), output);
+    }
+
+    // The sphere's radius and offset scale the unit sphere coordinates inside the noise domain,
+    // so the shared coordinates themselves are never copied
+    FastNoise::OutputMinMax GenerateOnPoints(const SphericalCoordinates& coords, float* output)
     {
-        return Sphere::GetSphericalCoordinates(radius, resolution, offset);
-    }    
+        return GenerateOnPoints(coords, 0, coords.x.size(), output);
+    }
+
+    // Only the points [begin, begin + count), so the noise of one texture can be generated in pieces on several threads
+    FastNoise::OutputMinMax GenerateOnPoints(const SphericalCoordinates& coords, const size_t begin, const size_t count,
+                                             float* output)
+    {
+        const int size = static_cast<int>(count);
+        PLANET_PROFILE_SCOPE_BYTES("Noise/Generate", static_cast<size_t>(size) * sizeof(float));
+        const glm::vec3 scale = glm::vec3(radius) + offset;
+        const auto& source = GetGenerator();
+        const auto node = scale == glm::vec3(1.0f) ? source : NoiseGraph::DomainAxisScale(source, scale);
+
+        return node.generator->GenPositionArray3D(output, size, coords.x.data() + begin, coords.y.data() + begin,
+                                                   coords.z.data() + begin, 0, 0, 0, seed);
+    }
 };
 }
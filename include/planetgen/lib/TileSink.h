@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace planet
+{
+// A rectangle of the material maps produced by tiled generation. Rows are tightly packed, with the per-map texel
+// formats of Material (RGBA8 albedo and emissive, RG8 normals, R8 roughness).
+struct MaterialTile
+{
+    int x = 0;  // Top left texel in the full texture
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    // nullptr for maps the layer does not produce
+    const unsigned char* albedo = nullptr;
+    const unsigned char* normal = nullptr;
+    const unsigned char* metallicRoughness = nullptr;
+    const unsigned char* emissive = nullptr;
+};
+
+// Destination of tiled generation. Tiles arrive in row major order, each one only valid during the Write() call.
+class TileSink
+{
+public:
+    virtual ~TileSink() = default;
+
+    virtual void Begin([[maybe_unused]] int width, [[maybe_unused]] int height) {}
+    virtual void Write(const MaterialTile& tile) = 0;
+    virtual void End() {}
+};
+
+// Writes every map into its own uncompressed 32 bit TGA, `<path>_albedo.tga` and so on. Compact maps are expanded
+// to RGBA first. Every tile row is written in place, so only a single tile is ever held in memory.
+class TgaTileSink : public TileSink
+{
+public:
+    explicit TgaTileSink(std::string path) : path(std::move(path)) {}
+
+    void Begin(int width, int height) override;
+    void Write(const MaterialTile& tile) override;
+    void End() override;
+
+    // False once any of the files could not be opened or written
+    bool IsGood() const { return isGood; }
+
+private:
+    enum Map { Albedo, Normal, MetallicRoughness, Emissive, MapCount };
+
+    std::string path;
+    int width = 0;
+    int height = 0;
+    bool isGood = true;
+    std::ofstream files[MapCount];
+    std::vector<unsigned char> row{};
+    std::vector<unsigned char> expanded{};
+
+    // `data` is RGBA8
+    void WriteMap(Map map, const unsigned char* data, const MaterialTile& tile);
+};
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace planet
+{
+// Worker threads with a task queue each. A worker runs its own queue newest first, so the tasks a task submits run
+// right after it on the same thread, and steals the oldest task of another queue once its own is empty.
+// Tasks run with OpenMP limited to one thread, the pool alone decides how many threads are busy.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // 0 threads picks one per hardware thread
+    explicit WorkStealingPool(int threads = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // From a task, onto its worker's own queue. From any other thread, onto the queues in turn.
+    void Submit(Task task);
+    // Runs `body` for every index in [0, count) on the pool and returns once all of them are done. The caller runs
+    // tasks itself while it waits, its own indices first, so it can be called from a task without idling a worker.
+    void ParallelFor(int count, const std::function<void(int)>& body);
+    // Blocks until every task submitted so far, and every task those submitted, has run. Never call it from a task.
+    void Wait();
+
+    [[nodiscard]] int GetThreadCount() const { return (int)workers.size(); }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex{};
+        std::deque<Task> tasks{};
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues{};
+    std::vector<std::thread> workers{};
+    std::atomic<size_t> queued{0};      // Tasks waiting in any queue
+    std::atomic<size_t> pending{0};     // Tasks submitted and not finished yet
+    std::atomic<size_t> nextQueue{0};
+
+    // Sleeping workers and waiters
+    std::mutex mutex{};
+    std::condition_variable wake{};
+    std::condition_variable done{};
+    bool isStopping = false;
+
+    // Newest task of the worker's own queue, or else the oldest one of the first other queue having any
+    bool TakeTask(size_t index, Task& task);
+    void RunTask(Task& task);
+    void Work(size_t index);
+};
+}
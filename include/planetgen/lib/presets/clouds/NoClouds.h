@@ -9,6 +9,11 @@ class NoClouds : public Clouds
 public:
     NoClouds() = default;
 
-    std::vector<float> GetNoiseData(glm::vec3 position) override { return {}; }
+    std::vector<float> GetNoiseData(glm::vec3) override { return {}; }
+    bool GetNoiseTile(glm::vec3, const SphericalCoordinates&, float*, const FastNoise::OutputMinMax&) override { return false; }
+    bool HasNoise() const override { return false; }
+
+protected:
+    NoiseNode BuildGenerator() override { return {}; }
 };
 }
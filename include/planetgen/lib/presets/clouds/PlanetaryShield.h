@@ -12,29 +12,21 @@ public:
         return {0.0f, 1.0f, 1.0f};
     }
     
-    void normalizeValues(std::vector<float>& data, const FastNoise::OutputMinMax& minmax)
+    bool UsesNoiseRange() const override { return true; }
+
+protected:
+    void NormalizeNoise(float* data, const size_t size, const FastNoise::OutputMinMax& range) override
     {
-        for (float& value : data)
+        for (size_t i = 0; i < size; i++)
         {
-            value = 0.5f + ((value - minmax.min) / (minmax.max - minmax.min));
+            data[i] = 0.5f + ((data[i] - range.min) / (range.max - range.min));
         }
     }
 
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+    NoiseNode BuildGenerator() override
     {
-        auto fnPerlin = FastNoise::New<FastNoise::CellularDistance>();
-        auto fnScale = FastNoise::New<FastNoise::DomainScale>();
-        fnScale->SetSource(fnPerlin);
-        fnScale->SetScale(5.0f);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        auto minmax = fnScale->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-        normalizeValues(output, minmax);
-
-        return output;
+        const auto fnPerlin = NoiseGraph::CellularDistance();
+        return NoiseGraph::DomainScale(fnPerlin, 5.0f);
     }
 };
 }
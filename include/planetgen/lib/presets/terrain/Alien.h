@@ -17,27 +17,12 @@ class Alien : public Terrain
             };
     }
     
-public:
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+protected:
+    NoiseNode BuildGenerator() override
     {
-        auto fnCellular = FastNoise::New<FastNoise::OpenSimplex2>();
-        auto fnPingPong = FastNoise::New<FastNoise::FractalRidged>();
-        fnPingPong->SetSource(fnCellular);
-        fnPingPong->SetGain(0.500f);
-        fnPingPong->SetWeightedStrength(0.000f);
-        fnPingPong->SetOctaveCount(3);
-        fnPingPong->SetLacunarity(2.000);
-        auto fnScale = FastNoise::New<FastNoise::DomainScale>();
-        fnScale->SetSource(fnPingPong);
-        fnScale->SetScale(1.0f);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        fnScale->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-        
-        return output;
+        const auto fnCellular = NoiseGraph::OpenSimplex2();
+        const auto fnPingPong = NoiseGraph::FractalRidged(fnCellular, 0.500f, 0.000f, 3, 2.000f);
+        return NoiseGraph::DomainScale(fnPingPong, 1.0f);
     }
 };
 }
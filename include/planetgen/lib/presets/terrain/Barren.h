@@ -16,31 +16,12 @@ class Barren : public Terrain
         };
     }
     
-public:
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+protected:
+    NoiseNode BuildGenerator() override
     {
-        auto fnSimplex = FastNoise::New<FastNoise::CellularDistance>();
-        auto fnFractal = FastNoise::New<FastNoise::FractalRidged>();
-        fnFractal->SetSource(fnSimplex);
-        fnFractal->SetGain(2.000f);
-        fnFractal->SetWeightedStrength(0.000f);
-        fnFractal->SetOctaveCount(2);
-        fnFractal->SetLacunarity(2.500);
-        auto fnScale = FastNoise::New<FastNoise::FractalPingPong>();
-        fnScale->SetSource(fnFractal);
-        fnScale->SetGain(0.500f);
-        fnScale->SetWeightedStrength(0.000f);
-        fnScale->SetPingPongStrength(2.000f);
-        fnScale->SetOctaveCount(3);
-        fnScale->SetLacunarity(2.000);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        fnScale->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-        
-        return output;
+        const auto fnSimplex = NoiseGraph::CellularDistance();
+        const auto fnFractal = NoiseGraph::FractalRidged(fnSimplex, 2.000f, 0.000f, 2, 2.500f);
+        return NoiseGraph::FractalPingPong(fnFractal, 0.500f, 0.000f, 2.000f, 3, 2.000f);
     }
 };
 }
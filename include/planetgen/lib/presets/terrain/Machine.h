@@ -14,43 +14,15 @@ class Machine : public Terrain
             };
     }
     
-public:
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+protected:
+    NoiseNode BuildGenerator() override
     {
-        auto fnPerlin = FastNoise::New<FastNoise::OpenSimplex2>();
-        auto fnFractal = FastNoise::New<FastNoise::FractalFBm>();
-        fnFractal->SetSource(fnPerlin);
-        fnFractal->SetGain(0.500f);
-        fnFractal->SetWeightedStrength(0.000f);
-        fnFractal->SetOctaveCount(3);
-        fnFractal->SetLacunarity(2.000);
-        auto fnFractal2 = FastNoise::New<FastNoise::FractalFBm>();
-        fnFractal2->SetSource(fnFractal);
-        fnFractal2->SetGain(0.500f);
-        fnFractal2->SetWeightedStrength(0.000f);
-        fnFractal2->SetOctaveCount(3);
-        fnFractal2->SetLacunarity(2.000);
-        auto fnFractal3 = FastNoise::New<FastNoise::FractalFBm>();
-        fnFractal3->SetSource(fnFractal2);
-        fnFractal3->SetGain(0.500f);
-        fnFractal3->SetWeightedStrength(0.000f);
-        fnFractal3->SetOctaveCount(3);
-        fnFractal3->SetLacunarity(2.000);
-        auto fnWarp = FastNoise::New<FastNoise::CellularLookup>();
-        fnWarp->SetLookup(fnFractal3);
-        fnWarp->SetJitterModifier(5.5f);
-        auto fnScale = FastNoise::New<FastNoise::DomainScale>();
-        fnScale->SetSource(fnWarp);
-        fnScale->SetScale(5.0f);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        auto minmax = fnScale->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-        // normalizeValues(output, minmax);
-
-        return output;
+        const auto fnPerlin = NoiseGraph::OpenSimplex2();
+        const auto fnFractal = NoiseGraph::FractalFBm(fnPerlin, 0.500f, 0.000f, 3, 2.000f);
+        const auto fnFractal2 = NoiseGraph::FractalFBm(fnFractal, 0.500f, 0.000f, 3, 2.000f);
+        const auto fnFractal3 = NoiseGraph::FractalFBm(fnFractal2, 0.500f, 0.000f, 3, 2.000f);
+        const auto fnWarp = NoiseGraph::CellularLookup(fnFractal3, 5.5f);
+        return NoiseGraph::DomainScale(fnWarp, 5.0f);
     }
 };
 }
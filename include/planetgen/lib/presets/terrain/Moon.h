@@ -21,26 +21,12 @@ public:
         };
     }
     
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+protected:
+    NoiseNode BuildGenerator() override
     {
-        auto fnSimplex = FastNoise::New<FastNoise::Simplex>();
-        auto fnFractal = FastNoise::New<FastNoise::FractalFBm>();
-        fnFractal->SetSource(fnSimplex);
-        fnFractal->SetGain(0.650f);
-        fnFractal->SetWeightedStrength(0.500f);
-        fnFractal->SetOctaveCount(4);
-        fnFractal->SetLacunarity(2.500);
-        auto fnScale = FastNoise::New<FastNoise::DomainScale>();
-        fnScale->SetSource(fnFractal);
-        fnScale->SetScale(0.8f);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        fnScale->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-        
-        return output;
+        const auto fnSimplex = NoiseGraph::Simplex();
+        const auto fnFractal = NoiseGraph::FractalFBm(fnSimplex, 0.650f, 0.500f, 4, 2.500f);
+        return NoiseGraph::DomainScale(fnFractal, 0.8f);
     }
 
     
@@ -25,32 +25,14 @@ public:
         };
     }
 
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+protected:
+    NoiseNode BuildGenerator() override
     {
-        auto fnPerlin = FastNoise::New<FastNoise::Perlin>();
-        auto fnFractal = FastNoise::New<FastNoise::FractalFBm>();
-        fnFractal->SetSource(fnPerlin);
-        fnFractal->SetGain(0.500f);
-        fnFractal->SetWeightedStrength(0.500f);
-        fnFractal->SetOctaveCount(3);
-        fnFractal->SetLacunarity(2.000);
-        auto fnScale = FastNoise::New<FastNoise::DomainScale>();
-        fnScale->SetSource(fnFractal);
-        fnScale->SetScale(12.0f);
-        auto fnSeed = FastNoise::New<FastNoise::SeedOffset>();
-        fnSeed->SetSource(fnScale);
-        fnSeed->SetOffset(1);
-        auto fnFade = FastNoise::New<FastNoise::MaxSmooth>();
-        fnFade->SetLHS(fnSeed);
-        fnFade->SetRHS(fnScale);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        fnFade->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-
-        return output;
+        const auto fnPerlin = NoiseGraph::Perlin();
+        const auto fnFractal = NoiseGraph::FractalFBm(fnPerlin, 0.500f, 0.500f, 3, 2.000f);
+        const auto fnScale = NoiseGraph::DomainScale(fnFractal, 12.0f);
+        const auto fnSeed = NoiseGraph::SeedOffset(fnScale, 1);
+        return NoiseGraph::MaxSmooth(fnSeed, fnScale);
     }
 };
 }
@@ -17,39 +17,15 @@ class Volcanic : public Terrain
             };
     }
     
-public:
-    std::vector<float> GetNoiseData(glm::vec3 position) override
+protected:
+    NoiseNode BuildGenerator() override
     {
-        auto fnCellular = FastNoise::New<FastNoise::CellularDistance>();
-        fnCellular->SetJitterModifier(1.360f);
-        fnCellular->SetReturnType(FastNoise::CellularDistance::ReturnType::Index0Add1);
-        auto fnPingPong = FastNoise::New<FastNoise::FractalPingPong>();
-        fnPingPong->SetSource(fnCellular);
-        fnPingPong->SetGain(0.500f);
-        fnPingPong->SetWeightedStrength(0.000f);
-        fnPingPong->SetPingPongStrength(2.640f);
-        fnPingPong->SetOctaveCount(3);
-        fnPingPong->SetLacunarity(2.000);
-        auto fnConstant = FastNoise::New<FastNoise::Constant>();
-        fnConstant->SetValue(-1.0f);
-        auto fnMax = FastNoise::New<FastNoise::Max>();
-        fnMax->SetLHS(fnPingPong);
-        fnMax->SetRHS(fnConstant);
-        auto fnTerrace = FastNoise::New<FastNoise::Terrace>();
-        fnTerrace->SetSource(fnMax);
-        fnTerrace->SetMultiplier(1.5f);
-        fnTerrace->SetSmoothness(-0.06f);
-        auto fnScale = FastNoise::New<FastNoise::DomainScale>();
-        fnScale->SetSource(fnTerrace);
-        fnScale->SetScale(1.0f);
-
-        const int size = resolution * resolution;
-        std::vector<float> output(size);
-
-        const auto coords = GetSphericalCoordinates();
-        fnScale->GenPositionArray3D(output.data(), size, coords.x.data(), coords.y.data(), coords.z.data(), 0, 0, 0, seed);
-        
-        return output;
+        const auto fnCellular = NoiseGraph::CellularDistance(1.360f, FastNoise::CellularDistance::ReturnType::Index0Add1);
+        const auto fnPingPong = NoiseGraph::FractalPingPong(fnCellular, 0.500f, 0.000f, 2.640f, 3, 2.000f);
+        const auto fnConstant = NoiseGraph::Constant(-1.0f);
+        const auto fnMax = NoiseGraph::Max(fnPingPong, fnConstant);
+        const auto fnTerrace = NoiseGraph::Terrace(fnMax, 1.5f, -0.06f);
+        return NoiseGraph::DomainScale(fnTerrace, 1.0f);
     }
 };
 }
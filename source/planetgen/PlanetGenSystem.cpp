@@ -1,11 +1,16 @@
 ﻿#include "planetgen/PlanetGenSystem.h"
 
+#include <filesystem>
+#include <iterator>
 #include <imgui/imgui.h>
 #include <glm/gtc/type_ptr.inl>
 #include "core/engine.hpp"
 #include "core/resources.hpp"
 #include "core/transform.hpp"
+#include "planetgen/lib/GlbExporter.h"
+#include "planetgen/lib/Ktx.h"
 #include "planetgen/lib/Planet.h"
+#include "planetgen/lib/Profiler.h"
 #include "planetgen/lib/presets/clouds/NoClouds.h"
 #include "planetgen/lib/presets/terrain/Gaia.h"
 #include "platform/opengl/mesh_gl.hpp"
@@ -17,11 +22,35 @@
 
 using namespace bee;
 
+namespace
+{
+// Passes tiles on to another sink, counting their texels for the progress of an export
+class ProgressTileSink : public planet::TileSink
+{
+public:
+    ProgressTileSink(planet::TileSink& target, std::atomic<int64_t>& texels) : target(target), texels(texels) {}
+
+    void Begin(const int width, const int height) override { target.Begin(width, height); }
+    void Write(const planet::MaterialTile& tile) override
+    {
+        target.Write(tile);
+        texels += static_cast<int64_t>(tile.width) * tile.height;
+    }
+    void End() override { target.End(); }
+
+private:
+    planet::TileSink& target;
+    std::atomic<int64_t>& texels;
+};
+}
+
 PlanetGenSystem::PlanetGenSystem()
 {
     factory = new planet::PlanetFactory();
     factory->registerDefaultTerrains();
     factory->registerDefaultClouds();
+    materialCache = std::make_unique<planet::MaterialCache>("cache/materials");
+    materialCache->SetBudget(1024ull * 1024 * 1024);
 
     Title = "Planet Generation";
 
@@ -58,10 +87,16 @@ PlanetGenSystem::PlanetGenSystem()
         auto terrain = new planet::Gaia();
         auto config = new planet::MeshConfig();
 
-        planet = new planet::Planet(terrain, clouds, config);
+        planet = new planet::Planet(terrain, clouds, config, materialCache.get());
+        planet->SetCancelFlag(&cancelRebuild);
+        meshConfig = *config;
         auto [myTerrain, myClouds] = planet->GetMeshes();
-        auto terrainMats = planet->GetTerrainMaterial();
-        auto cloudMats = planet->GetCloudMaterial();
+        const auto& terrainMats = planet->GetTerrainMaterial();
+        const auto& cloudMats = planet->GetCloudMaterial();
+        planet->TakePendingUploads(planet::Layer::Terrain);
+        planet->TakePendingUploads(planet::Layer::Clouds);
+        terrainStats = planet->GetTerrainStats();
+        cloudStats = planet->GetCloudStats();
 
         // Clouds
         {
@@ -113,8 +148,29 @@ PlanetGenSystem::PlanetGenSystem()
     }
 }
 
+PlanetGenSystem::~PlanetGenSystem()
+{
+    if (exportJob.valid())
+    {
+        cancelExport = true;
+        exportJob.wait();
+    }
+    if (rebuildJob.valid())
+    {
+        cancelRebuild = true;
+        rebuildJob.wait();
+    }
+    if (systemJob.valid())
+    {
+        cancelSystem = true;
+        systemJob.wait();
+    }
+}
+
 void PlanetGenSystem::Update(const float dt)
 {
+    PollRebuild();
+
     cloudsTransform->RotationEuler += cloudsRotationVelocity * dt;
     cloudsTransform->Rotation = glm::quat(glm::radians(cloudsTransform->RotationEuler));
     
@@ -122,11 +178,11 @@ void PlanetGenSystem::Update(const float dt)
     planetTransform->Rotation = glm::quat(glm::radians(planetTransform->RotationEuler));
 }
 
-void PlanetGenSystem::RebuildTerrain(bool keepColors)
+std::shared_future<void> PlanetGenSystem::RebuildTerrain(bool keepColors)
 {
-    std::vector<std::pair<float, glm::vec3>> palette{};
     if (keepColors)
     {
+        std::vector<std::pair<float, glm::vec3>> palette{};
         for (int i = 0; i < state.ColorCount; i++)
         {
             auto color = *state.GetColorMarker(i);
@@ -135,46 +191,326 @@ void PlanetGenSystem::RebuildTerrain(bool keepColors)
                 glm::vec3(color.Color[0], color.Color[1], color.Color[2])
             );
         }
+        return SubmitEdit([palette](planet::Planet& planet) { planet.SetTerrainColors(palette); });
     }
-    
+
+    // The preset's own palette replaces the gradient once the rebuild is done
+    queuedRefresh.terrain = true;
+    return SubmitEdit([](planet::Planet&) {});
+}
+
+std::shared_future<void> PlanetGenSystem::RebuildClouds(bool keepColor)
+{
+    if (keepColor)
+    {
+        return SubmitEdit([color = cloudColor](planet::Planet& planet) { planet.SetCloudColor(color); });
+    }
+
+    queuedRefresh.clouds = true;
+    return SubmitEdit([](planet::Planet&) {});
+}
+
+std::shared_future<void> PlanetGenSystem::SubmitEdit(std::function<void(planet::Planet&)> edit)
+{
+    queuedEdits.push_back(std::move(edit));
+    queuedWaiters.emplace_back();
+    std::shared_future<void> done = queuedWaiters.back().get_future().share();
+
+    if (rebuildJob.valid())
+    {
+        cancelRebuild = true;
+    }
+    PollRebuild();
+
+    return done;
+}
+
+void PlanetGenSystem::WaitForRebuild()
+{
+    while (rebuildJob.valid() || exportJob.valid())
+    {
+        if (exportJob.valid())
+        {
+            exportJob.wait();
+        }
+        else
+        {
+            rebuildJob.wait();
+        }
+        PollRebuild();
+    }
+}
+
+void PlanetGenSystem::GenerateSystem()
+{
+    systemPlanetCount = (int)systemRecipes.size();
+    systemPlanetsDone = 0;
+    systemFailures = 0;
+    cancelSystem = false;
+    systemJob = std::async(std::launch::async, [this, recipes = systemRecipes,
+                                                cache = isCacheEnabled ? materialCache.get() : nullptr]()
+    {
+        std::error_code error;
+        std::filesystem::create_directories("system", error);
+
+        planet::WorkStealingPool pool;
+        planet::SolarSystem system(*factory, cache);
+        system.SetCancelFlag(&cancelSystem);
+        for (const auto& recipe : recipes)
+        {
+            system.Add(recipe);
+        }
+
+        // Every planet is written out the moment it's done, so nothing but its file outlives the callback
+        system.Generate(pool, [this](const size_t index, planet::SystemPlanet& entry)
+        {
+            const std::string path = "system/planet_" + std::to_string(index) + ".glb";
+            systemFailures += planet::ExportGlb(*entry.planet, path) ? 0 : 1;
+            entry.planet.reset();
+            systemPlanetsDone++;
+        });
+    });
+}
+
+void PlanetGenSystem::ExportTiledMaps(const int resolution)
+{
+    WaitForRebuild();
+    cancelExport = false;
+    exportedTexels = 0;
+    exportTexels = 2 * static_cast<int64_t>(resolution) * resolution;
+    exportJob = std::async(std::launch::async, [this, resolution]() -> std::string
+    {
+        // No rebuild runs until the export is collected, so the planet listens to the export's flag meanwhile
+        planet->SetCancelFlag(&cancelExport);
+        planet::TgaTileSink terrainSink("planet_terrain");
+        ProgressTileSink terrainProgress(terrainSink, exportedTexels);
+        planet::TgaTileSink cloudSink("planet_clouds");
+        ProgressTileSink cloudProgress(cloudSink, exportedTexels);
+        const bool isFinished = planet->GenerateTiled(planet::Layer::Terrain, resolution, terrainProgress) &&
+            planet->GenerateTiled(planet::Layer::Clouds, resolution, cloudProgress);
+        planet->SetCancelFlag(&cancelRebuild);
+
+        if (!isFinished)
+        {
+            return "Tiled export cancelled, the written maps are incomplete";
+        }
+        if (!terrainSink.IsGood() || !cloudSink.IsGood())
+        {
+            return "Failed to write the tiled maps";
+        }
+        return {};
+    });
+}
+
+void PlanetGenSystem::ExportKtx2(const planet::KtxOptions& options)
+{
+    WaitForRebuild();
+    exportTexels = 0;
+    exportJob = std::async(std::launch::async, [this, options]() -> std::string
+    {
+        // Levels and blocks the materials keep are written as they are, the rest is generated while writing
+        const bool isWritten = planet::WriteMaterialKtx2(planet->GetTerrainMaterial(), "planet_terrain", options) &&
+            planet::WriteMaterialKtx2(planet->GetCloudMaterial(), "planet_clouds", options);
+        return isWritten ? std::string() : "Failed to write the KTX2 maps";
+    });
+}
+
+void PlanetGenSystem::ExportGlb()
+{
+    WaitForRebuild();
+    exportTexels = 0;
+    exportJob = std::async(std::launch::async, [this]() -> std::string
+    {
+        if (!planet::ExportGlb(*planet, "planet.glb"))
+        {
+            return "Failed to export planet.glb, only equirectangular planets can be exported";
+        }
+        return {};
+    });
+}
+
+void PlanetGenSystem::PollRebuild()
+{
+    if (rebuildJob.valid())
+    {
+        if (rebuildJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            UploadPreviews();
+            return;
+        }
+
+        // Maps finished before a cancellation are still uploaded, the rest stays dirty for the next job
+        const bool isFinished = rebuildJob.get();
+        UploadMaterials();
+        if (isFinished)
+        {
+            RefreshColors(runningRefresh);
+            for (auto& waiter : runningWaiters)
+            {
+                waiter.set_value();
+            }
+            runningWaiters.clear();
+        }
+        else
+        {
+            std::move(runningWaiters.begin(), runningWaiters.end(), std::back_inserter(queuedWaiters));
+            runningWaiters.clear();
+            queuedRefresh.terrain |= runningRefresh.terrain;
+            queuedRefresh.clouds |= runningRefresh.clouds;
+        }
+        runningRefresh = {};
+    }
+
+    if (exportJob.valid())
+    {
+        if (exportJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return;
+        }
+
+        const std::string error = exportJob.get();
+        if (!error.empty())
+        {
+            Log::Error("{}", error);
+        }
+    }
+
+    if (queuedEdits.empty())
+    {
+        return;
+    }
+
+    // Previews of the superseded rebuild would only flash outdated parameters
+    {
+        std::lock_guard lock(previewMutex);
+        terrainPreview.reset();
+        cloudPreview.reset();
+    }
+
+    cancelRebuild = false;
+    runningWaiters = std::move(queuedWaiters);
+    queuedWaiters.clear();
+    runningRefresh = queuedRefresh;
+    queuedRefresh = {};
+    rebuildJob = std::async(std::launch::async, [this, edits = std::move(queuedEdits), preview = previewResolution]
+    {
+        for (const auto& edit : edits)
+        {
+            edit(*planet);
+        }
+
+        planet->RebuildProgressive(planet::Layer::Terrain, preview, [this](planet::Material&& material)
+        {
+            auto taken = std::make_shared<planet::Material>(std::move(material));
+            std::lock_guard lock(previewMutex);
+            terrainPreview = std::move(taken);
+        });
+        planet->RebuildProgressive(planet::Layer::Clouds, preview, [this](planet::Material&& material)
+        {
+            auto taken = std::make_shared<planet::Material>(std::move(material));
+            std::lock_guard lock(previewMutex);
+            cloudPreview = std::move(taken);
+        });
+        return !planet->IsCancelled();
+    });
+    queuedEdits.clear();
+}
+
+void PlanetGenSystem::UploadPreviews()
+{
+    std::shared_ptr<planet::Material> terrainMaterial, cloudMaterial;
+    {
+        std::lock_guard lock(previewMutex);
+        terrainMaterial = std::move(terrainPreview);
+        cloudMaterial = std::move(cloudPreview);
+        terrainPreview.reset();
+        cloudPreview.reset();
+    }
+
+    if (!terrainMaterial && !cloudMaterial)
+    {
+        return;
+    }
+
+    const auto view = Engine.ECS().Registry.view<const Transform, MeshRenderer>();
+    for (const auto& entity : view)
+    {
+        auto [transform, mesh] = view.get(entity);
+        if (transform.Name == planetName && terrainMaterial)
+        {
+            UpdateMaterial(*mesh.Material, *terrainMaterial, planet::StageMaps);
+        }
+        else if (transform.Name == CloudName && cloudMaterial)
+        {
+            UpdateMaterial(*mesh.Material, *cloudMaterial, planet::StageMaps);
+        }
+    }
+}
+
+void PlanetGenSystem::UploadMaterials()
+{
     const auto view = Engine.ECS().Registry.view<const Transform, MeshRenderer>();
     for (const auto& entity : view)
     {
         auto [transform, mesh] = view.get(entity);
         if (transform.Name == planetName)
         {
-            auto material = keepColors ? planet->GetTerrainMaterial(palette) : planet->GetTerrainMaterial();
-            mesh.Material = CreateMaterial(material);
-            for (int i = 8; i >= 0; i--)
+            const uint32_t uploads = planet->TakePendingUploads(planet::Layer::Terrain);
+            if (uploads & planet::StageMesh)
             {
-                state.RemoveColorMarker(i);
+                mesh.Mesh = CreateMesh(planet->GetTerrainMesh());
             }
-
-            auto colors = planet->GetTerrainColors();
-            for (const auto& color : colors)
+            UpdateMaterial(*mesh.Material, planet->GetTerrainMaterial(), uploads);
+        }
+        else if (transform.Name == CloudName)
+        {
+            const uint32_t uploads = planet->TakePendingUploads(planet::Layer::Clouds);
+            if (uploads & planet::StageMesh)
             {
-                state.AddColorMarker(color.first, {color.second.r,color.second.g,color.second.b}, 1.0f);
+                mesh.Mesh = CreateMesh(planet->GetCloudMesh());
             }
-            break;
+            UpdateMaterial(*mesh.Material, planet->GetCloudMaterial(), uploads);
         }
     }
+    terrainStats = planet->GetTerrainStats();
+    cloudStats = planet->GetCloudStats();
 }
 
-void PlanetGenSystem::RebuildClouds(bool keepColor)
+void PlanetGenSystem::RefreshColors(const ColorRefresh& refresh)
 {
-    const auto cview = Engine.ECS().Registry.view<const Transform, MeshRenderer>();
-    for (const auto& entity : cview)
+    if (refresh.terrain)
     {
-        auto [transform, mesh] = cview.get(entity);
-        if (transform.Name == CloudName)
+        for (int i = 8; i >= 0; i--)
         {
-            auto material = keepColor ? planet->GetCloudMaterial(cloudColor) : planet->GetCloudMaterial();
-            mesh.Material = CreateMaterial(material);
+            state.RemoveColorMarker(i);
+        }
 
-            cloudColor = planet->GetCloudColor();
-            break;
+        auto colors = planet->GetTerrainColors();
+        for (const auto& color : colors)
+        {
+            state.AddColorMarker(color.first, {color.second.r,color.second.g,color.second.b}, 1.0f);
         }
     }
+
+    if (refresh.clouds)
+    {
+        cloudColor = planet->GetCloudColor();
+    }
+}
+
+void PlanetGenSystem::RebuildMeshes()
+{
+    // The displaced terrain reads the noise of the rebuild job, so the meshes are rebuilt on it as well
+    // and picked up with the maps once it is done
+    SubmitEdit([config = meshConfig](planet::Planet& planet)
+    {
+        planet::MeshConfig& target = *planet.GetConfig();
+        target.type = config.type;
+        target.stacks = config.stacks;
+        target.sectors = config.sectors;
+        target.subdivisions = config.subdivisions;
+        planet.RebuildMeshes();
+    });
 }
 
 #ifdef BEE_INSPECTOR
@@ -182,12 +518,9 @@ void PlanetGenSystem::Inspect()
 {
     // All
     // TODO: Reset to defaults button
-    // TODO: Export (gltf) planet button
-    // TODO: Add planet to list for generating solar system
 
     // Terrain
     // TODO: Auto rebuild on water level change
-    // TODO: normal strength sliders for water and land
     // TODO: Add terrain to list of structs with planet configs
 
     // Clouds
@@ -211,9 +544,12 @@ void PlanetGenSystem::Inspect()
             {
                 currentTerrain = terrain;
                 auto newTerrain = factory->instantiateTerrain(currentTerrain);
-                newTerrain->SetSeed(planet->GetTerrain()->GetSeed());
-                newTerrain->SetTextureResolution(planet->GetTerrain()->GetTextureResolution());
-                planet->SetTerrain(newTerrain);
+                SubmitEdit([newTerrain](planet::Planet& planet)
+                {
+                    newTerrain->SetSeed(planet.GetTerrain()->GetSeed());
+                    newTerrain->SetTextureResolution(planet.GetTerrain()->GetTextureResolution());
+                    planet.SetTerrain(newTerrain);
+                });
                 
                 RebuildTerrain(false);
             }
@@ -225,8 +561,7 @@ void PlanetGenSystem::Inspect()
     static int terrainSeed = 1337;
     if (ImGui::InputInt("Seed##terrain", &terrainSeed))
     {
-        planet->GetTerrain()->SetSeed(terrainSeed);
-        planet->SetTerrain(planet->GetTerrain());
+        SubmitEdit([seed = terrainSeed](planet::Planet& planet) { planet.GetTerrain()->SetSeed(seed); });
         RebuildTerrain();
     }
 
@@ -246,19 +581,25 @@ void PlanetGenSystem::Inspect()
 
         if (terrainResolution != terrainPrevResolution)
         {
-            planet->GetTerrain()->SetTextureResolution(terrainResolution);
-            planet->SetTerrain(planet->GetTerrain());
+            SubmitEdit([resolution = terrainResolution](planet::Planet& planet)
+            {
+                planet.GetTerrain()->SetTextureResolution(resolution);
+            });
             RebuildTerrain();
         }
 
         terrainPrevResolution = terrainResolution;
     }
+    ImGui::Text("Noise Range: %.3f - %.3f", terrainStats.min, terrainStats.max);
 
-    bool emissive = planet->GetTerrain()->IsEmissive();
+    static bool emissive = planet->GetTerrain()->IsEmissive();
     if (ImGui::Checkbox("Emissive", &emissive))
     {
-        planet->GetTerrain()->SetEmissive(emissive);
-        planet->SetTerrain(planet->GetTerrain());
+        SubmitEdit([isEmissive = emissive](planet::Planet& planet)
+        {
+            planet.GetTerrain()->SetEmissive(isEmissive);
+            planet.MarkDirty(planet::Layer::Terrain, planet::StageEmissive);
+        });
         RebuildTerrain();
     }
 
@@ -267,7 +608,20 @@ void PlanetGenSystem::Inspect()
     static float waterLevel = planet->GetWaterLevel();
     if (ImGui::DragFloat("Water Level", &waterLevel, 0.01f, 0.0f, 1.0f))
     {
-        planet->SetWaterLevel(waterLevel);
+        SubmitEdit([level = waterLevel](planet::Planet& planet) { planet.SetWaterLevel(level); });
+        RebuildTerrain();
+    }
+
+    static float landNormalStrength = planet->GetLandNormalStrength();
+    static float waterNormalStrength = planet->GetWaterNormalStrength();
+    const bool isLandChanged = ImGui::DragFloat("Land Normal Strength", &landNormalStrength, 0.1f, 0.1f, 100.0f);
+    const bool isWaterChanged = ImGui::DragFloat("Water Normal Strength", &waterNormalStrength, 0.1f, 0.1f, 100.0f);
+    if (isLandChanged || isWaterChanged)
+    {
+        SubmitEdit([land = landNormalStrength, water = waterNormalStrength](planet::Planet& planet)
+        {
+            planet.SetNormalStrength(land, water);
+        });
         RebuildTerrain();
     }
 
@@ -324,9 +678,12 @@ void PlanetGenSystem::Inspect()
             {
                 currentCloud = cloud;
                 auto newClouds = factory->instantiateClouds(currentCloud);
-                newClouds->SetSeed(planet->GetClouds()->GetSeed());
-                newClouds->SetTextureResolution(planet->GetClouds()->GetTextureResolution());
-                planet->SetClouds(newClouds);
+                SubmitEdit([newClouds](planet::Planet& planet)
+                {
+                    newClouds->SetSeed(planet.GetClouds()->GetSeed());
+                    newClouds->SetTextureResolution(planet.GetClouds()->GetTextureResolution());
+                    planet.SetClouds(newClouds);
+                });
 
                 RebuildClouds(false);
             }
@@ -338,8 +695,7 @@ void PlanetGenSystem::Inspect()
     static int cloudSeed = 1337;
     if (ImGui::InputInt("Seed##clouds", &cloudSeed))
     {
-        planet->GetClouds()->SetSeed(cloudSeed);
-        planet->SetClouds(planet->GetClouds());
+        SubmitEdit([seed = cloudSeed](planet::Planet& planet) { planet.GetClouds()->SetSeed(seed); });
         RebuildClouds();
     }
 
@@ -359,13 +715,16 @@ void PlanetGenSystem::Inspect()
 
         if (cloudResolution != cloudPrevResolution)
         {
-            planet->GetClouds()->SetTextureResolution(cloudResolution);
-            planet->SetClouds(planet->GetClouds());
+            SubmitEdit([resolution = cloudResolution](planet::Planet& planet)
+            {
+                planet.GetClouds()->SetTextureResolution(resolution);
+            });
             RebuildClouds();
         }
 
         cloudPrevResolution = cloudResolution;
     }
+    ImGui::Text("Noise Range: %.3f - %.3f", cloudStats.min, cloudStats.max);
     
     ImGui::DragFloat3("Cloud Velocity", glm::value_ptr(cloudsRotationVelocity));
     ImGui::ColorEdit3("Color##Clouds", glm::value_ptr(cloudColor), ImGuiColorEditFlags_Float | ImGuiColorEditFlags_HDR);
@@ -374,48 +733,230 @@ void PlanetGenSystem::Inspect()
     ImGui::Dummy(ImVec2(0, 5));
     ImGui::Separator();
     ImGui::Dummy(ImVec2(0, 5));
-    if (ImGui::Button("Rebuild Planet"))
+
+    bool meshChanged = false;
+    const char* meshTypes[] = {"UV Sphere", "Cube Sphere"};
+    int meshType = static_cast<int>(meshConfig.type);
+    if (ImGui::Combo("Mesh", &meshType, meshTypes, IM_ARRAYSIZE(meshTypes)))
     {
-        std::vector<std::pair<float, glm::vec3>> palette{};
-        for (int i = 0; i < state.ColorCount; i++)
+        meshConfig.type = static_cast<planet::MeshType>(meshType);
+        meshChanged = true;
+    }
+    if (meshConfig.type == planet::MeshType::Cube)
+    {
+        meshChanged |= ImGui::SliderInt("Subdivisions", &meshConfig.subdivisions, 1, 512);
+    }
+    else
+    {
+        meshChanged |= ImGui::SliderInt("Stacks", &meshConfig.stacks, 2, 512);
+        meshChanged |= ImGui::SliderInt("Sectors", &meshConfig.sectors, 3, 1024);
+    }
+    if (meshChanged)
+    {
+        RebuildMeshes();
+    }
+
+    // Real relief for close-ups, tessellation above decides how much of it the mesh can show
+    static float displacement = 0.0f;
+    if (ImGui::SliderFloat("Displacement", &displacement, 0.0f, 0.1f, "%.3f"))
+    {
+        meshConfig.displacement = displacement;
+        SubmitEdit([amplitude = displacement](planet::Planet& planet) { planet.SetDisplacement(amplitude); });
+    }
+
+    if (ImGui::Checkbox("Disk Cache", &isCacheEnabled))
+    {
+        SubmitEdit([this, cached = isCacheEnabled](planet::Planet& planet)
         {
-            auto color = *state.GetColorMarker(i);
-            palette.emplace_back(
-                color.Position,
-                glm::vec3(color.Color[0], color.Color[1], color.Color[2])
-            );
-        }
+            planet.SetMaterialCache(cached ? materialCache.get() : nullptr);
+        });
+    }
+
+    bool isPreviewing = previewResolution > 0;
+    if (ImGui::Checkbox("Progressive Preview", &isPreviewing))
+    {
+        previewResolution = isPreviewing ? 256 : 0;
+    }
 
-        auto terrainMats = planet->GetTerrainMaterial(palette);
-        const auto view = Engine.ECS().Registry.view<const Transform, MeshRenderer>();
-        for (const auto& entity : view)
+    // Tiled export streams the maps straight to disk, so it isn't bound by the viewport resolution limit
+    static int exportResolution = 16384;
+    ImGui::InputInt("Export Resolution", &exportResolution, 1024, 4096);
+    exportResolution = std::clamp(exportResolution, 256, 32768);
+    const bool isExporting = exportJob.valid();
+    if (isExporting)
+    {
+        if (exportTexels > 0)
         {
-            auto [transform, mesh] = view.get(entity);
-            if (transform.Name == planetName)
+            ImGui::Text("Exporting %.0f%%", 100.0 * (double)exportedTexels.load() / (double)exportTexels);
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel##export"))
             {
-                mesh.Material = CreateMaterial(terrainMats);
-                break;
+                cancelExport = true;
             }
         }
+        else
+        {
+            ImGui::Text("Exporting...");
+        }
+    }
+    ImGui::BeginDisabled(isExporting);
+    if (ImGui::Button("Export Tiled Maps"))
+    {
+        ExportTiledMaps(exportResolution);
+    }
+    ImGui::EndDisabled();
+
+    // The viewport uploads the plain maps and lets the GPU build their mips, the pyramid is only kept for KTX2 export
+    static bool isMipmapped = false;
+    if (ImGui::Checkbox("KTX2 CPU Mipmaps", &isMipmapped))
+    {
+        SubmitEdit([mipmapped = isMipmapped](planet::Planet& planet) { planet.SetMipmapped(mipmapped); });
+    }
+
+    // Same for the compressed copies, which the KTX2 files then store instead of the raw maps
+    static bool isCompressed = false;
+    if (ImGui::Checkbox("KTX2 Block Compression", &isCompressed))
+    {
+        SubmitEdit([compressed = isCompressed](planet::Planet& planet) { planet.SetCompressed(compressed); });
+    }
+
+    ImGui::BeginDisabled(isExporting);
+    if (ImGui::Button("Export KTX2"))
+    {
+        planet::KtxOptions options;
+        options.isBlockCompressed = isCompressed;
+        ExportKtx2(options);
+    }
+    ImGui::EndDisabled();
+
+    ImGui::BeginDisabled(isExporting);
+    if (ImGui::Button("Export GLB"))
+    {
+        ExportGlb();
+    }
+    ImGui::EndDisabled();
+
+    if (ImGui::Button("Rebuild Planet"))
+    {
+        RebuildTerrain();
+        RebuildClouds();
+    }
+
+    // ---------------- SOLAR SYSTEM ---------------- //
+    ImGui::Dummy(ImVec2(0, 5));
+    ImGui::Separator();
+    ImGui::Dummy(ImVec2(0, 5));
+    ImGui::Text("Solar System");
+    ImGui::Dummy(ImVec2(0, 5));
+
+    const bool isSystemRunning = systemJob.valid() &&
+        systemJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    if (systemJob.valid() && !isSystemRunning)
+    {
+        systemJob.get();
+        Log::Info("Generated {} planet(s) into system/, {} failed to export", systemPlanetsDone.load(), systemFailures.load());
+    }
+
+    if (ImGui::Button("Add To System"))
+    {
+        planet::PlanetRecipe recipe;
+        recipe.terrain = currentTerrain;
+        recipe.clouds = currentCloud;
+        recipe.seed = terrainSeed;
+        recipe.resolution = terrainResolution;
+        recipe.mesh = meshConfig;
+        systemRecipes.push_back(recipe);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear System"))
+    {
+        systemRecipes.clear();
+    }
+
+    for (const auto& recipe : systemRecipes)
+    {
+        ImGui::BulletText("%s, %s clouds, seed %d, %d", recipe.terrain.c_str(), recipe.clouds.c_str(), recipe.seed,
+                          recipe.resolution);
+    }
+
+    if (isSystemRunning)
+    {
+        ImGui::Text("Generating %d / %d", systemPlanetsDone.load(), systemPlanetCount);
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel##system"))
+        {
+            cancelSystem = true;
+        }
+    }
+    else if (!systemRecipes.empty() && ImGui::Button("Generate System"))
+    {
+        GenerateSystem();
+    }
+
+    ImGui::End();
+
+#ifdef PLANETGEN_PROFILING
+    InspectProfiler();
+#endif
+}
+
+#ifdef PLANETGEN_PROFILING
+void PlanetGenSystem::InspectProfiler()
+{
+    ImGui::Begin("Planet Profiler");
+
+    if (ImGui::Button("Clear"))
+    {
+        planet::Profiler::Clear();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Write Trace"))
+    {
+        if (planet::Profiler::WriteChromeTrace("planet_trace.json"))
+        {
+            Log::Info("Wrote planet_trace.json");
+        }
+        else
+        {
+            Log::Error("Failed to write planet_trace.json");
+        }
+    }
 
-        auto cloudMats = planet->GetCloudMaterial(cloudColor);
-        const auto cloudview = Engine.ECS().Registry.view<const Transform, MeshRenderer>();
-        for (const auto& entity : cloudview)
+    if (ImGui::BeginTable("Stages", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Stage");
+        ImGui::TableSetupColumn("Last ms");
+        ImGui::TableSetupColumn("Avg ms");
+        ImGui::TableSetupColumn("Calls");
+        ImGui::TableSetupColumn("Threads");
+        ImGui::TableSetupColumn("MiB");
+        ImGui::TableHeadersRow();
+
+        for (const auto& stage : planet::Profiler::GetStats())
         {
-            auto [transform, mesh] = cloudview.get(entity);
-            if (transform.Name == CloudName)
-            {
-                mesh.Material = CreateMaterial(cloudMats);
-                break;
-            }
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(stage.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stage.lastMs);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stage.totalMs / (double)stage.calls);
+            ImGui::TableNextColumn();
+            ImGui::Text("%lld", (long long)stage.calls);
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", stage.threads);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", (double)stage.lastBytes / (1024.0 * 1024.0));
         }
+        ImGui::EndTable();
     }
 
     ImGui::End();
 }
 #endif
+#endif
 
-std::shared_ptr<bee::Mesh> PlanetGenSystem::CreateMesh(planet::Mesh& mesh)
+std::shared_ptr<bee::Mesh> PlanetGenSystem::CreateMesh(const planet::Mesh& mesh)
 {
     auto output = Engine.Resources().Create<Mesh>();
     output->SetIndices(mesh.indices);
@@ -423,83 +964,113 @@ std::shared_ptr<bee::Mesh> PlanetGenSystem::CreateMesh(planet::Mesh& mesh)
     output->SetAttribute(Mesh::Attribute::Normal, mesh.normals);
     output->SetAttribute(Mesh::Attribute::Texture, mesh.uvs);
 
-    std::vector<uint32_t> indices(mesh.indices.begin(), mesh.indices.end());
-    auto tans = output->ComputeTangents(mesh.positions, mesh.normals, mesh.uvs, indices);
+    auto tans = output->ComputeTangents(mesh.positions, mesh.normals, mesh.uvs, mesh.indices);
     output->SetAttribute(Mesh::Attribute::Tangent, tans);
 
     return output;
 }
 
-std::shared_ptr<bee::Material> PlanetGenSystem::CreateMaterial(planet::Material& material)
+std::shared_ptr<bee::Material> PlanetGenSystem::CreateMaterial(const planet::Material& material)
 {
     auto output = std::make_shared<Material>();
+    UpdateMaterial(*output, material, planet::StageMaps);
+
+    return output;
+}
+
+void PlanetGenSystem::UpdateMaterial(bee::Material& output, const planet::Material& material, uint32_t maps)
+{
+    // The PBR shader samples the maps as 2D textures with the mesh UVs, cubemaps are for export only
+    if (material.layout != planet::TextureLayout::Equirectangular)
+    {
+        Log::Warn("Skipping the upload of a cubemap material, the viewport only renders equirectangular maps");
+        return;
+    }
+
     auto sampler = std::make_shared<Sampler>();
 
     // Albedo
-    if (!material.albedo.empty())
+    if (maps & planet::StageAlbedo && !material.albedo.empty())
     {
         Log::Info("Albedo");
+        PLANET_PROFILE_SCOPE_BYTES("Upload/Albedo", material.albedo.size());
         auto albedo = std::make_shared<Image>("Albedo", true);
-        albedo->CreateGLTextureWithData(material.albedo.data(), material.resolution, material.resolution, material.channels, true);
+        albedo->CreateGLTextureWithData(material.albedo.data(), material.resolution, material.resolution, planet::Material::albedoChannels, true);
         const auto albedoTexture = std::make_shared<Texture>(albedo, sampler);
 
-        output->BaseColorTexture = albedoTexture;
-        output->UseBaseTexture = true;
-        output->BaseColorFactor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+        output.BaseColorTexture = albedoTexture;
+        output.UseBaseTexture = true;
+        output.BaseColorFactor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
     }
 
     // Emissive
-    if (!material.emissive.empty())
+    const auto& emissiveMap = material.GetEmissive();
+    if (maps & planet::StageEmissive && emissiveMap.empty())
+    {
+        output.EmissiveTexture = nullptr;
+        output.UseEmissiveTexture = false;
+    }
+    else if (maps & planet::StageEmissive)
     {
         Log::Info("Emissive");
+        PLANET_PROFILE_SCOPE_BYTES("Upload/Emissive", emissiveMap.size());
         auto emissive = std::make_shared<Image>("Emissive", true);
-        emissive->CreateGLTextureWithData(material.emissive.data(), material.resolution, material.resolution, material.channels, true);
+        emissive->CreateGLTextureWithData(emissiveMap.data(), material.resolution, material.resolution, planet::Material::emissiveChannels, true);
         const auto emissiveTexture = std::make_shared<Texture>(emissive, sampler);
 
-        output->EmissiveTexture = emissiveTexture;
-        output->UseEmissiveTexture = true;
-        output->EmissiveFactor = glm::vec3(0.0f, 0.0f, 0.0f);
+        output.EmissiveTexture = emissiveTexture;
+        output.UseEmissiveTexture = true;
+        output.EmissiveFactor = glm::vec3(0.0f, 0.0f, 0.0f);
     }
 
     // Normal
-    if (!material.normal.empty())
+    if (maps & planet::StageNormal && material.normal.empty())
+    {
+        output.NormalTexture = nullptr;
+        output.UseNormalTexture = false;
+    }
+    else if (maps & planet::StageNormal)
     {
         Log::Info("Normal");
+        PLANET_PROFILE_SCOPE_BYTES("Upload/Normal", material.normal.size());
+        // The PBR shader samples XYZ, so Z is reconstructed here rather than in every fragment
+        const auto normalRGBA = material.GetNormalRGBA();
         auto normal = std::make_shared<Image>("Normal", true);
-        normal->CreateGLTextureWithData(material.normal.data(), material.resolution, material.resolution, material.channels, true);
+        normal->CreateGLTextureWithData(normalRGBA.data(), material.resolution, material.resolution, 4, true);
         const auto normalTexture = std::make_shared<Texture>(normal, sampler);
 
-        output->NormalTexture = normalTexture;
-        output->UseNormalTexture = true;
-        output->NormalTextureScale = 1.0f;
+        output.NormalTexture = normalTexture;
+        output.UseNormalTexture = true;
+        output.NormalTextureScale = 1.0f;
     }
 
     // Occlusion
     if (!material.occlusion.empty())
     {
         Log::Info("Occlusion");
+        PLANET_PROFILE_SCOPE_BYTES("Upload/Occlusion", material.occlusion.size());
         auto occlusion = std::make_shared<Image>("Occlusion", true);
-        occlusion->CreateGLTextureWithData(material.occlusion.data(), material.resolution, material.resolution, material.channels, true);
+        occlusion->CreateGLTextureWithData(material.occlusion.data(), material.resolution, material.resolution, planet::Material::occlusionChannels, true);
         auto occlusionTexture = std::make_shared<Texture>(occlusion, sampler);
 
-        output->OcclusionTexture = occlusionTexture;
-        output->UseOcclusionTexture = true;
-        output->OcclusionTextureStrength = 1.0f;
+        output.OcclusionTexture = occlusionTexture;
+        output.UseOcclusionTexture = true;
+        output.OcclusionTextureStrength = 1.0f;
     }
 
     // Metallic/Roughness
-    if (!material.metallicRoughness.empty())
+    if (maps & planet::StageRoughness && !material.metallicRoughness.empty())
     {
         Log::Info("Metallic/Roughness");
+        PLANET_PROFILE_SCOPE_BYTES("Upload/Metallic/Roughness", material.metallicRoughness.size());
+        const auto metallicRoughnessRGBA = material.GetMetallicRoughnessRGBA();
         auto metallicRoughness = std::make_shared<Image>("Metallic/Roughness", true);
-        metallicRoughness->CreateGLTextureWithData(material.metallicRoughness.data(), material.resolution, material.resolution, material.channels, true);
+        metallicRoughness->CreateGLTextureWithData(metallicRoughnessRGBA.data(), material.resolution, material.resolution, 4, true);
         auto metallicRoughnessTexture = std::make_shared<Texture>(metallicRoughness, sampler);
 
-        output->MetallicRoughnessTexture = metallicRoughnessTexture;
-        output->UseMetallicRoughnessTexture = true;
-        output->MetallicFactor = 1.0f;
-        output->RoughnessFactor = 1.0f;
+        output.MetallicRoughnessTexture = metallicRoughnessTexture;
+        output.UseMetallicRoughnessTexture = true;
+        output.MetallicFactor = 1.0f;
+        output.RoughnessFactor = 1.0f;
     }
-
-    return output;
 }
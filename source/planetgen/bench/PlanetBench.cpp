@@ -0,0 +1,558 @@
+﻿// Microbenchmarks for the planet library, written as JSON so runs can be diffed.
+//
+//     PlanetBench --min-resolution 256 --max-resolution 4096 --threads 8 --repeats 5 --output bench.json
+//
+// Every case runs at each power of two resolution and each power of two thread count up to --threads.
+// Cases: the GetNoiseData of every preset, equirectangular coordinate generation, UV and cube sphere meshes,
+// the albedo, Sobel normal and ORM stages of a terrain rebuild, and the Sobel kernel against the scalar reference.
+//
+//     PlanetBench --verify
+//
+// checks the Sobel kernel against the scalar reference byte for byte, the layers of the GLB export of every cloud
+// preset, and that the chunks of a refined LOD quadtree cover the sphere without cracks, and exits non-zero on any
+// difference.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "planetgen/lib/GlbExporter.h"
+#include "planetgen/lib/LodTerrain.h"
+#include "planetgen/lib/NormalMap.h"
+#include "planetgen/lib/Planet.h"
+#include "planetgen/lib/PlanetFactory.h"
+#include "omp.h"
+
+namespace
+{
+struct BenchConfig
+{
+    int minResolution = 256;
+    int maxResolution = 4096;
+    int maxThreads = 0;     // 0 uses every hardware thread
+    int repeats = 5;
+    std::string filter{};   // Only cases with this in their name
+    std::string output{};   // stdout when empty
+    bool verify = false;    // Only run the kernel exactness checks
+};
+
+struct BenchResult
+{
+    std::string name;
+    int resolution = 0;
+    int threads = 0;
+    std::vector<double> milliseconds{};
+};
+
+class Bench
+{
+public:
+    explicit Bench(const BenchConfig& config) : config(config) {}
+
+    // Times `run` after a single warm up call, `setup` runs untimed before every call
+    void Run(const std::string& name, const int resolution, const int threads, const std::function<void()>& run,
+             const std::function<void()>& setup = {})
+    {
+        if (!config.filter.empty() && name.find(config.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        omp_set_num_threads(threads);
+        BenchResult result{name, resolution, threads};
+        for (int i = 0; i <= config.repeats; i++)
+        {
+            if (setup) setup();
+            const auto start = std::chrono::steady_clock::now();
+            run();
+            const auto end = std::chrono::steady_clock::now();
+
+            if (i > 0)
+            {
+                result.milliseconds.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            }
+        }
+
+        std::fprintf(stderr, "%-40s %5d %3d threads %10.3f ms\n", name.c_str(), resolution, threads, GetMedian(result));
+        results.push_back(std::move(result));
+    }
+
+    bool Write() const
+    {
+        FILE* file = config.output.empty() ? stdout : std::fopen(config.output.c_str(), "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        std::fprintf(file, "{\n  \"hardwareThreads\": %u,\n  \"repeats\": %d,\n  \"results\": [\n",
+                     std::thread::hardware_concurrency(), config.repeats);
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const auto& result = results[i];
+            const auto [min, max] = std::minmax_element(result.milliseconds.begin(), result.milliseconds.end());
+            double sum = 0.0;
+            for (const double milliseconds : result.milliseconds) sum += milliseconds;
+
+            std::fprintf(file,
+                         "    {\"name\": \"%s\", \"resolution\": %d, \"threads\": %d, "
+                         "\"minMs\": %.4f, \"medianMs\": %.4f, \"meanMs\": %.4f, \"maxMs\": %.4f}%s\n",
+                         result.name.c_str(), result.resolution, result.threads, *min, GetMedian(result),
+                         sum / (double)result.milliseconds.size(), *max, i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(file, "  ]\n}\n");
+
+        return file == stdout || std::fclose(file) == 0;
+    }
+
+private:
+    const BenchConfig& config;
+    std::vector<BenchResult> results{};
+
+    static double GetMedian(const BenchResult& result)
+    {
+        auto sorted = result.milliseconds;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+bool ParseArguments(const int argc, char** argv, BenchConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--verify")
+        {
+            config.verify = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "Missing value for '%s'\n", argument.c_str());
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (argument == "--min-resolution") config.minResolution = std::atoi(value);
+        else if (argument == "--max-resolution") config.maxResolution = std::atoi(value);
+        else if (argument == "--threads") config.maxThreads = std::atoi(value);
+        else if (argument == "--repeats") config.repeats = std::atoi(value);
+        else if (argument == "--filter") config.filter = value;
+        else if (argument == "--output") config.output = value;
+        else
+        {
+            std::fprintf(stderr, "Unknown argument '%s'\n", argument.c_str());
+            return false;
+        }
+    }
+
+    return config.minResolution > 0 && config.maxResolution >= config.minResolution && config.repeats > 0;
+}
+
+// The Sobel filter as the material generators used to run it, a full 3x3 kernel with wrapped loads per texel
+void ReferenceNormalRow(const float* top, const float* center, const float* bottom, const int width, const bool wrap,
+                        const planet::NormalStrength& strength, unsigned char* output)
+{
+    for (int x = 0; x < width; x++)
+    {
+        const int left = wrap ? (x - 1 + width) % width : x - 1;
+        const int right = wrap ? (x + 1) % width : x + 1;
+        const float noiseValue = (center[x] + 1.0f) * 0.5f;
+        const float bump = noiseValue >= strength.threshold ? strength.land : strength.water;
+
+        const float tl = (top[left] + 1.0f) * 0.5f;
+        const float t = (top[x] + 1.0f) * 0.5f;
+        const float tr = (top[right] + 1.0f) * 0.5f;
+
+        const float l = (center[left] + 1.0f) * 0.5f;
+        const float r = (center[right] + 1.0f) * 0.5f;
+
+        const float bl = (bottom[left] + 1.0f) * 0.5f;
+        const float b = (bottom[x] + 1.0f) * 0.5f;
+        const float br = (bottom[right] + 1.0f) * 0.5f;
+
+        float dX = -((tr + 2.0f * r + br) - (tl + 2.0f * l + bl));
+        float dY = -((bl + 2.0f * b + br) - (tl + 2.0f * t + tr));
+        const float dZ = 1.0f / bump;
+        const float len = sqrtf(dX * dX + dY * dY + dZ * dZ);
+        dX /= len;
+        dY /= len;
+
+        output[x * 2 + 0] = (unsigned char)((dX * 0.5f + 0.5f) * 255.f);
+        output[x * 2 + 1] = (unsigned char)((dY * 0.5f + 0.5f) * 255.f);
+    }
+}
+
+// Runs a normal kernel over a whole equirectangular heightfield, rows past the poles wrap like Planet does
+void RunNormals(const decltype(&ReferenceNormalRow) kernel, const std::vector<float>& noise, const int resolution,
+                const planet::NormalStrength& strength, std::vector<unsigned char>& output)
+{
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int y = 0; y < resolution; y++)
+    {
+        const float* top = &noise[static_cast<size_t>(y == 0 ? resolution - 1 : y - 1) * resolution];
+        const float* center = &noise[static_cast<size_t>(y) * resolution];
+        const float* bottom = &noise[static_cast<size_t>(y == resolution - 1 ? 0 : y + 1) * resolution];
+        kernel(top, center, bottom, resolution, true, strength, &output[static_cast<size_t>(y) * resolution * 2]);
+    }
+}
+
+// Compares the kernel with the reference on wrapped rows and apron rows of odd widths, on both random values and real
+// terrain noise, and returns the number of differing bytes
+size_t VerifyNormals(planet::PlanetFactory& factory)
+{
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    const planet::NormalStrength strengths[] = {{15.0f, 3.0f, 0.54f}, {60.0f, 3.0f, 0.3f}, {3.0f, 3.0f, 0.54f}};
+
+    size_t mismatches = 0;
+    for (const int width : {1, 2, 7, 255, 256, 257, 1000, 2048})
+    {
+        for (const bool isNoise : {false, true})
+        {
+            // Three rows plus a one texel apron on either side
+            const int stride = width + 2;
+            std::vector<float> rows(static_cast<size_t>(stride) * 3);
+            if (isNoise)
+            {
+                planet::Terrain* terrain = factory.instantiateTerrain("Gaia");
+                terrain->SetTextureResolution(stride);
+                const auto noise = terrain->GetNoiseData(glm::vec3(0.0f));
+                std::copy(noise.begin() + static_cast<std::ptrdiff_t>(stride) * (stride / 2 - 1),
+                          noise.begin() + static_cast<std::ptrdiff_t>(stride) * (stride / 2 + 2), rows.begin());
+                delete terrain;
+            }
+            else
+            {
+                for (float& value : rows) value = distribution(random);
+            }
+
+            for (const bool wrap : {true, false})
+            {
+                for (const auto& strength : strengths)
+                {
+                    // Wrapped rows start at the first texel, apron rows one in so column -1 is readable
+                    const float* top = rows.data() + (wrap ? 0 : 1);
+                    const float* center = top + stride;
+                    const float* bottom = center + stride;
+
+                    std::vector<unsigned char> expected(static_cast<size_t>(width) * 2);
+                    std::vector<unsigned char> actual(expected.size());
+                    ReferenceNormalRow(top, center, bottom, width, wrap, strength, expected.data());
+                    planet::ComputeNormalRow(top, center, bottom, width, wrap, strength, actual.data());
+
+                    for (size_t i = 0; i < expected.size(); i++)
+                    {
+                        mismatches += expected[i] != actual[i];
+                    }
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+// Meshes in the JSON chunk of a GLB, 0 when it can't be read
+size_t CountGlbMeshes(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    uint32_t header[5] = {};   // Magic, version, length, then the length and type of the JSON chunk
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header)))
+    {
+        return 0;
+    }
+
+    std::string json(header[3], '\0');
+    if (!file.read(json.data(), static_cast<std::streamsize>(json.size())))
+    {
+        return 0;
+    }
+
+    size_t meshes = 0;
+    for (size_t i = json.find("\"primitives\""); i != std::string::npos; i = json.find("\"primitives\"", i + 1))
+    {
+        meshes++;
+    }
+    return meshes;
+}
+
+// Exports a small planet with every cloud preset and returns the number of exports with the wrong layers: the terrain
+// alone for presets without clouds, the terrain and the clouds otherwise
+size_t VerifyGlb(planet::PlanetFactory& factory)
+{
+    size_t mismatches = 0;
+    for (const auto& name : factory.GetClouds())
+    {
+        planet::Terrain* terrain = factory.instantiateTerrain("Gaia");
+        planet::Clouds* clouds = factory.instantiateClouds(name);
+        terrain->SetTextureResolution(64);
+        clouds->SetTextureResolution(64);
+        planet::MeshConfig config{};
+
+        size_t meshes = 0;
+        {
+            planet::Planet planet(terrain, clouds, &config);
+            const auto path = std::filesystem::temp_directory_path() / ("PlanetBench_" + name + ".glb");
+            if (planet::ExportGlb(planet, path.string()))
+            {
+                meshes = CountGlbMeshes(path);
+            }
+            std::error_code error;
+            std::filesystem::remove(path, error);
+        }
+
+        const size_t expected = clouds->HasNoise() ? 2 : 1;
+        if (meshes != expected)
+        {
+            std::fprintf(stderr, "glb with %s clouds: %zu meshes instead of %zu\n", name.c_str(), meshes, expected);
+            mismatches++;
+        }
+
+        delete terrain;
+        delete clouds;
+    }
+
+    return mismatches;
+}
+
+// Refines the quadtree of a displaced planet around a camera close to its surface until no chunk is missing, then
+// returns the number of problems: selected chunks not covering the cube exactly once, and border vertices off every
+// border of the other chunks, which would open a crack
+size_t VerifyLod(planet::PlanetFactory& factory)
+{
+    planet::Terrain* terrain = factory.instantiateTerrain("Gaia");
+    planet::Clouds* clouds = factory.instantiateClouds("None");
+    terrain->SetTextureResolution(64);
+    clouds->SetTextureResolution(64);
+    planet::MeshConfig meshConfig{};
+    meshConfig.displacement = 0.05f;
+
+    size_t problems = 0;
+    {
+        planet::Planet planet(terrain, clouds, &meshConfig);
+        planet::LodConfig config{};
+        config.maxLevel = 5;
+        config.chunkQuads = 6;
+        config.tileResolution = 8;
+        planet::LodTerrain lod(planet, config);
+        if (lod.GetConfig().chunkQuads != 8)
+        {
+            std::fprintf(stderr, "lod: %d quads per chunk edge instead of 8\n", lod.GetConfig().chunkQuads);
+            problems++;
+        }
+
+        const glm::vec3 camera = glm::normalize(glm::vec3(0.3f, 0.2f, 1.0f)) * 1.02f;
+        std::vector<const planet::LodChunk*> selection = lod.Update(camera);
+        for (int i = 0; i < 10000 && lod.GetPendingCount() > 0; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            selection = lod.Update(camera);
+        }
+        // Once more, so the chunks finished since the last update are selected and stitched as well
+        for (size_t count = 0; count != selection.size() || lod.GetPendingCount() > 0;)
+        {
+            count = selection.size();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            selection = lod.Update(camera);
+        }
+
+        double area = 0.0;
+        int deepest = 0;
+        for (const planet::LodChunk* chunk : selection)
+        {
+            area += 1.0 / (double)(1ll << (2 * chunk->level));
+            deepest = std::max(deepest, chunk->level);
+        }
+        if (area != 6.0 || deepest != config.maxLevel)
+        {
+            std::fprintf(stderr, "lod: %zu chunks cover %g faces down to level %d\n", selection.size(), area, deepest);
+            problems++;
+        }
+
+        // Vertex (i, j) of a chunk lies at index i * (quads + 1) + j, its border runs around the four edges
+        const int quads = lod.GetConfig().chunkQuads;
+        const auto getBorder = [quads](const planet::LodChunk& chunk)
+        {
+            std::vector<glm::vec3> border;
+            for (int k = 0; k <= quads; k++) border.push_back(chunk.mesh.positions[k]);
+            for (int k = 1; k <= quads; k++) border.push_back(chunk.mesh.positions[k * (quads + 1) + quads]);
+            for (int k = quads - 1; k >= 0; k--) border.push_back(chunk.mesh.positions[quads * (quads + 1) + k]);
+            for (int k = quads - 1; k >= 0; k--) border.push_back(chunk.mesh.positions[k * (quads + 1)]);
+            return border;
+        };
+        const auto getDistance = [](const glm::vec3 point, const glm::vec3 a, const glm::vec3 b)
+        {
+            const glm::vec3 ab = b - a;
+            const float t = glm::clamp(glm::dot(point - a, ab) / std::max(glm::dot(ab, ab), 1e-20f), 0.0f, 1.0f);
+            return glm::length(point - (a + ab * t));
+        };
+
+        std::vector<std::vector<glm::vec3>> borders;
+        for (const planet::LodChunk* chunk : selection)
+        {
+            borders.push_back(getBorder(*chunk));
+        }
+        size_t cracks = 0;
+        for (size_t chunk = 0; chunk < borders.size(); chunk++)
+        {
+            for (const glm::vec3& vertex : borders[chunk])
+            {
+                bool isOnBorder = false;
+                for (size_t other = 0; other < borders.size() && !isOnBorder; other++)
+                {
+                    const auto& border = borders[other];
+                    for (size_t k = 0; other != chunk && k + 1 < border.size() && !isOnBorder; k++)
+                    {
+                        isOnBorder = getDistance(vertex, border[k], border[k + 1]) < 1e-5f;
+                    }
+                }
+                cracks += !isOnBorder;
+            }
+        }
+        if (cracks > 0)
+        {
+            std::fprintf(stderr, "lod: %zu border vertices of %zu chunks open a crack\n", cracks, selection.size());
+            problems++;
+        }
+    }
+
+    delete terrain;
+    delete clouds;
+    return problems;
+}
+
+// The terrain stages on their own, the noise stays cached in the planet between runs
+void BenchStages(Bench& bench, planet::PlanetFactory& factory, const int resolution, const int threads)
+{
+    const std::pair<const char*, uint32_t> stages[] = {
+        {"stage/albedo", planet::StageAlbedo},
+        {"stage/normal", planet::StageNormal},
+        {"stage/roughness", planet::StageRoughness},
+        {"stage/maps", planet::StageMaps},
+        {"stage/mesh", planet::StageMesh},
+    };
+
+    planet::Terrain* terrain = factory.instantiateTerrain("Gaia");
+    planet::Clouds* clouds = factory.instantiateClouds("None");
+    terrain->SetTextureResolution(resolution);
+    // Displaced like sphere/cube is tessellated, so stage/mesh covers sampling the noise and the normals
+    planet::MeshConfig config{};
+    config.type = planet::MeshType::Cube;
+    config.subdivisions = resolution / 16;
+    config.displacement = 0.02f;
+    {
+        planet::Planet gaia(terrain, clouds, &config);
+        for (const auto& [name, stage] : stages)
+        {
+            bench.Run(name, resolution, threads, [&]() { gaia.RebuildTerrain(); },
+                      [&, stage = stage]() { gaia.MarkDirty(planet::Layer::Terrain, stage); });
+        }
+    }
+
+    delete terrain;
+    delete clouds;
+}
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if (!ParseArguments(argc, argv, config))
+    {
+        std::fprintf(stderr, "Usage: PlanetBench [--min-resolution 256] [--max-resolution 4096] [--threads N] "
+                             "[--repeats 5] [--filter name] [--output file.json] [--verify]\n");
+        return 1;
+    }
+
+    const int maxThreads = config.maxThreads > 0 ? config.maxThreads : std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> threadCounts{};
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    planet::PlanetFactory factory;
+    factory.registerDefaultTerrains();
+    factory.registerDefaultClouds();
+
+    if (config.verify)
+    {
+        const size_t mismatches = VerifyNormals(factory);
+        std::fprintf(stderr, "normal kernel: %zu mismatching bytes\n", mismatches);
+        const size_t glbMismatches = VerifyGlb(factory);
+        std::fprintf(stderr, "glb layers: %zu mismatching exports\n", glbMismatches);
+        const size_t lodProblems = VerifyLod(factory);
+        std::fprintf(stderr, "lod quadtree: %zu problems\n", lodProblems);
+        return mismatches == 0 && glbMismatches == 0 && lodProblems == 0 ? 0 : 1;
+    }
+
+    Bench bench(config);
+    for (int resolution = config.minResolution; resolution <= config.maxResolution; resolution *= 2)
+    {
+        // Noise generation is a single FastNoise call, so it runs once per resolution
+        for (const auto& name : factory.GetTerrains())
+        {
+            planet::Terrain* terrain = factory.instantiateTerrain(name);
+            terrain->SetTextureResolution(resolution);
+            bench.Run("noise/terrain/" + name, resolution, 1, [&]() { terrain->GetNoiseData(glm::vec3(0.0f)); });
+            delete terrain;
+        }
+        for (const auto& name : factory.GetClouds())
+        {
+            planet::Clouds* clouds = factory.instantiateClouds(name);
+            clouds->SetTextureResolution(resolution);
+            bench.Run("noise/clouds/" + name, resolution, 1, [&]() { clouds->GetNoiseData(glm::vec3(0.0f)); });
+            delete clouds;
+        }
+
+        for (const int threads : threadCounts)
+        {
+            bench.Run("sphere/coordinates", resolution, threads,
+                      [&]() { planet::Sphere::GetTileCoordinates(resolution, 0, 0, resolution, resolution); });
+
+            // Mesh tessellation grows with the resolution so the mesh cases scale like the others
+            bench.Run("sphere/uv", resolution, threads, [&]() { planet::Sphere::UV(1.0f, resolution / 8, resolution / 4); });
+            bench.Run("sphere/cube", resolution, threads, [&]() { planet::Sphere::Cube(1.0f, resolution / 16); });
+
+            BenchStages(bench, factory, resolution, threads);
+        }
+
+        // The Sobel kernel on its own, against the scalar filter it replaced
+        {
+            planet::Terrain* terrain = factory.instantiateTerrain("Gaia");
+            terrain->SetTextureResolution(resolution);
+            const auto noise = terrain->GetNoiseData(glm::vec3(0.0f));
+            delete terrain;
+
+            const planet::NormalStrength strength{15.0f * (float)resolution / 256.f, 3.0f, 0.54f};
+            std::vector<unsigned char> normals(static_cast<size_t>(resolution) * resolution * 2);
+            for (const int threads : threadCounts)
+            {
+                bench.Run("kernel/normal", resolution, threads,
+                          [&]() { RunNormals(planet::ComputeNormalRow, noise, resolution, strength, normals); });
+                bench.Run("kernel/normal-reference", resolution, threads,
+                          [&]() { RunNormals(ReferenceNormalRow, noise, resolution, strength, normals); });
+            }
+        }
+    }
+
+    if (!bench.Write())
+    {
+        std::fprintf(stderr, "Can't write '%s'\n", config.output.c_str());
+        return 1;
+    }
+
+    return 0;
+}
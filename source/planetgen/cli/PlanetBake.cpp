@@ -0,0 +1,323 @@
+﻿// Headless planet baker, generates the materials of a range of seeds without the engine or a window.
+//
+//     PlanetBake --terrain Gaia --clouds Cirrus --seeds 1-64 --resolution 2048 --output bakes/gaia
+//
+// Planets are spread over worker threads, and every worker gets an even share of the OpenMP threads
+// so the per-planet parallel loops don't oversubscribe the machine.
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <tinygltf/stb_image_write.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "planetgen/lib/Ktx.h"
+#include "planetgen/lib/MaterialCache.h"
+#include "planetgen/lib/Planet.h"
+#include "planetgen/lib/PlanetFactory.h"
+#include "omp.h"
+
+namespace
+{
+struct BakeConfig
+{
+    std::string terrain = "Gaia";
+    std::string clouds = "None";
+    int firstSeed = 1337;
+    int lastSeed = 1337;
+    int resolution = 1024;
+    planet::TextureLayout layout = planet::TextureLayout::Equirectangular;
+    std::filesystem::path output = ".";
+    int jobs = 0;   // Planets generated at the same time, 0 picks one per four hardware threads
+    std::filesystem::path cache{};  // Material cache directory, none when empty
+    bool isKtx2 = false;            // One KTX2 file with mips per map instead of PNGs
+    planet::KtxOptions ktx{};
+};
+
+std::mutex printMutex;
+
+void PrintUsage()
+{
+    std::printf(
+        "Usage: PlanetBake [options]\n"
+        "  --terrain <preset>     Terrain preset (default Gaia)\n"
+        "  --clouds <preset>      Cloud preset (default None)\n"
+        "  --seeds <first[-last]> Seed or inclusive seed range (default 1337)\n"
+        "  --resolution <size>    Texture resolution (default 1024)\n"
+        "  --cubemap              Write six cube faces per map instead of an equirectangular image\n"
+        "  --output <directory>   Output directory, created when missing (default .)\n"
+        "  --jobs <count>         Planets generated in parallel\n"
+        "  --cache <directory>    Reuse and fill a material cache, shared with the viewer\n"
+        "  --ktx2                 Write KTX2 textures with full mip chains instead of PNGs\n"
+        "  --bc                   Block compress the KTX2 textures (BC1/BC3/BC4/BC5)\n"
+        "  --zstd                 Zstandard supercompress the KTX2 textures\n"
+        "  --list                 List the available presets\n");
+}
+
+void ListPresets(const planet::PlanetFactory& factory)
+{
+    std::printf("Terrains:\n");
+    for (const auto& name : factory.GetTerrains())
+    {
+        std::printf("  %s\n", name.c_str());
+    }
+    std::printf("Clouds:\n");
+    for (const auto& name : factory.GetClouds())
+    {
+        std::printf("  %s\n", name.c_str());
+    }
+}
+
+// Preset names like "Machine World" become "Machine_World" in file names
+std::string ToFileName(std::string name)
+{
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return name;
+}
+
+bool ParseArguments(const int argc, char** argv, BakeConfig& config, bool& listPresets)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (argument == "--list")
+        {
+            listPresets = true;
+        }
+        else if (argument == "--ktx2")
+        {
+            config.isKtx2 = true;
+        }
+        else if (argument == "--bc")
+        {
+            config.ktx.isBlockCompressed = true;
+        }
+        else if (argument == "--zstd")
+        {
+            config.ktx.isSupercompressed = true;
+        }
+        else if (argument == "--cubemap")
+        {
+            config.layout = planet::TextureLayout::Cubemap;
+        }
+        else if (argument == "--terrain" && hasValue)
+        {
+            config.terrain = argv[++i];
+        }
+        else if (argument == "--clouds" && hasValue)
+        {
+            config.clouds = argv[++i];
+        }
+        else if (argument == "--seeds" && hasValue)
+        {
+            const std::string seeds = argv[++i];
+            const size_t dash = seeds.find('-', 1);
+            config.firstSeed = std::atoi(seeds.substr(0, dash).c_str());
+            config.lastSeed = dash == std::string::npos ? config.firstSeed : std::atoi(seeds.substr(dash + 1).c_str());
+        }
+        else if (argument == "--resolution" && hasValue)
+        {
+            config.resolution = std::atoi(argv[++i]);
+        }
+        else if (argument == "--output" && hasValue)
+        {
+            config.output = argv[++i];
+        }
+        else if (argument == "--jobs" && hasValue)
+        {
+            config.jobs = std::atoi(argv[++i]);
+        }
+        else if (argument == "--cache" && hasValue)
+        {
+            config.cache = argv[++i];
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown or incomplete argument '%s'\n", argument.c_str());
+            return false;
+        }
+    }
+
+    if (config.resolution < 16 || config.lastSeed < config.firstSeed)
+    {
+        std::fprintf(stderr, "Invalid resolution or seed range\n");
+        return false;
+    }
+
+#ifndef PLANETGEN_WITH_ZSTD
+    if (config.ktx.isSupercompressed)
+    {
+        std::fprintf(stderr, "--zstd needs a build with PLANETGEN_WITH_ZSTD\n");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// Writes every map of a material as RGBA, one image per cube face for cubemaps. Empty maps are skipped.
+bool WriteMaterial(const planet::Material& material, const std::filesystem::path& prefix)
+{
+    static const char* FACE_NAMES[] = {"px", "nx", "py", "ny", "pz", "nz"};
+    const auto normal = material.GetNormalRGBA();
+    const auto metallicRoughness = material.GetMetallicRoughnessRGBA();
+    const std::pair<const char*, const std::vector<unsigned char>*> maps[] = {
+        {"albedo", &material.albedo},
+        {"normal", &normal},
+        {"metallicRoughness", &metallicRoughness},
+        {"emissive", &material.GetEmissive()},
+    };
+
+    const int faces = material.GetFaceCount();
+    const size_t faceSize = static_cast<size_t>(material.resolution) * material.resolution * 4;
+    bool isWritten = true;
+    for (const auto& [name, data] : maps)
+    {
+        if (data->empty())
+        {
+            continue;
+        }
+
+        for (int face = 0; face < faces; face++)
+        {
+            std::string path = prefix.string() + "_" + name;
+            if (faces > 1)
+            {
+                path += std::string("_") + FACE_NAMES[face];
+            }
+            path += ".png";
+
+            isWritten &= stbi_write_png(path.c_str(), material.resolution, material.resolution, 4,
+                                        data->data() + face * faceSize, material.resolution * 4) != 0;
+        }
+    }
+
+    return isWritten;
+}
+
+bool BakePlanet(planet::PlanetFactory& factory, const BakeConfig& config, planet::MaterialCache* cache, const int seed)
+{
+    // The planet doesn't own its textures
+    planet::Terrain* terrain = factory.instantiateTerrain(config.terrain);
+    planet::Clouds* clouds = factory.instantiateClouds(config.clouds);
+    for (planet::Texture* texture : {static_cast<planet::Texture*>(terrain), static_cast<planet::Texture*>(clouds)})
+    {
+        texture->SetSeed(seed);
+        texture->SetTextureResolution(config.resolution);
+        texture->SetLayout(config.layout);
+    }
+
+    planet::MeshConfig meshConfig{};
+    bool isWritten = false;
+    {
+        planet::Planet planet(terrain, clouds, &meshConfig, cache);
+
+        // Nothing is rebuilt afterwards, so there is no point in keeping the noise around
+        planet.SetNoiseCacheBudget(0);
+
+        const std::string name = ToFileName(config.terrain) + "_" + std::to_string(seed);
+        const auto terrainPrefix = config.output / (name + "_terrain");
+        const auto cloudPrefix = config.output / (name + "_clouds_" + ToFileName(config.clouds));
+        if (config.isKtx2)
+        {
+            isWritten = planet::WriteMaterialKtx2(planet.GetTerrainMaterial(), terrainPrefix.string(), config.ktx);
+            isWritten &= planet::WriteMaterialKtx2(planet.GetCloudMaterial(), cloudPrefix.string(), config.ktx);
+        }
+        else
+        {
+            isWritten = WriteMaterial(planet.GetTerrainMaterial(), terrainPrefix);
+            isWritten &= WriteMaterial(planet.GetCloudMaterial(), cloudPrefix);
+        }
+    }
+
+    delete terrain;
+    delete clouds;
+    return isWritten;
+}
+}
+
+int main(int argc, char** argv)
+{
+    planet::PlanetFactory factory;
+    factory.registerDefaultTerrains();
+    factory.registerDefaultClouds();
+
+    BakeConfig config;
+    bool listPresets = false;
+    if (!ParseArguments(argc, argv, config, listPresets))
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (listPresets)
+    {
+        ListPresets(factory);
+        return 0;
+    }
+
+    const auto terrains = factory.GetTerrains();
+    const auto clouds = factory.GetClouds();
+    if (std::find(terrains.begin(), terrains.end(), config.terrain) == terrains.end() ||
+        std::find(clouds.begin(), clouds.end(), config.clouds) == clouds.end())
+    {
+        std::fprintf(stderr, "Unknown preset, see --list\n");
+        return 1;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(config.output, error);
+    if (error)
+    {
+        std::fprintf(stderr, "Can't create '%s': %s\n", config.output.string().c_str(), error.message().c_str());
+        return 1;
+    }
+
+    const int planets = config.lastSeed - config.firstSeed + 1;
+    const int hardwareThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int jobs = std::clamp(config.jobs > 0 ? config.jobs : hardwareThreads / 4, 1, planets);
+    const int threadsPerJob = std::max(1, hardwareThreads / jobs);
+
+    // Entries are written through temporary files, so every worker can share one cache
+    std::unique_ptr<planet::MaterialCache> cache;
+    if (!config.cache.empty())
+    {
+        cache = std::make_unique<planet::MaterialCache>(config.cache);
+    }
+
+    std::atomic<int> nextSeed = config.firstSeed;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> workers;
+    workers.reserve(jobs);
+    for (int job = 0; job < jobs; job++)
+    {
+        workers.emplace_back([&]()
+        {
+            omp_set_num_threads(threadsPerJob);
+            for (int seed = nextSeed++; seed <= config.lastSeed; seed = nextSeed++)
+            {
+                const bool isWritten = BakePlanet(factory, config, cache.get(), seed);
+                failures += isWritten ? 0 : 1;
+
+                std::lock_guard lock(printMutex);
+                std::printf("%s seed %d%s\n", config.terrain.c_str(), seed, isWritten ? "" : " failed to write");
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    std::printf("Baked %d planet(s) with %d job(s) of %d thread(s)\n", planets - failures, jobs, threadsPerJob);
+    return failures == 0 ? 0 : 1;
+}
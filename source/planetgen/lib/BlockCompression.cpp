@@ -0,0 +1,219 @@
+﻿#include "planetgen/lib/BlockCompression.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+// Extracts a 4x4 block, clamping at the image edges
+void LoadBlock(const unsigned char* face, const int resolution, const int channels, const int blockX, const int blockY,
+               unsigned char block[16][4])
+{
+    for (int y = 0; y < 4; y++)
+    {
+        const int row = std::min(blockY * 4 + y, resolution - 1);
+        for (int x = 0; x < 4; x++)
+        {
+            const int column = std::min(blockX * 4 + x, resolution - 1);
+            const unsigned char* texel = face + (static_cast<size_t>(row) * resolution + column) * channels;
+            for (int channel = 0; channel < 4; channel++)
+            {
+                block[y * 4 + x][channel] = channel < channels ? texel[channel] : 255;
+            }
+        }
+    }
+}
+
+uint16_t To565(const int r, const int g, const int b)
+{
+    return static_cast<uint16_t>(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+void From565(const uint16_t color, int rgb[3])
+{
+    const int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+    rgb[0] = r << 3 | r >> 2;
+    rgb[1] = g << 2 | g >> 4;
+    rgb[2] = b << 3 | b >> 2;
+}
+
+// BC1 color block, always in four color mode, endpoints from the inset bounding box of the block
+void EncodeColorBlock(const unsigned char block[16][4], uint8_t* output)
+{
+    int min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            min[c] = std::min(min[c], (int)block[i][c]);
+            max[c] = std::max(max[c], (int)block[i][c]);
+        }
+    }
+
+    // Insetting by 1/16th of the range moves the endpoints onto the colors the block actually uses
+    for (int c = 0; c < 3; c++)
+    {
+        const int inset = (max[c] - min[c]) >> 4;
+        min[c] = std::min(255, min[c] + inset);
+        max[c] = std::max(0, max[c] - inset);
+    }
+
+    // The endpoints span the box diagonal the colors run along, channels falling while the widest one rises get flipped
+    int axis = 0;
+    for (int c = 1; c < 3; c++)
+    {
+        if (max[c] - min[c] > max[axis] - min[axis]) axis = c;
+    }
+    const int axisCenter = (min[axis] + max[axis]) / 2;
+    for (int c = 0; c < 3; c++)
+    {
+        const int center = (min[c] + max[c]) / 2;
+        int covariance = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            covariance += ((int)block[i][axis] - axisCenter) * ((int)block[i][c] - center);
+        }
+        if (covariance < 0)
+        {
+            std::swap(min[c], max[c]);
+        }
+    }
+
+    uint16_t color0 = To565(max[0], max[1], max[2]);
+    uint16_t color1 = To565(min[0], min[1], min[2]);
+    if (color0 < color1)
+    {
+        std::swap(color0, color1);
+    }
+
+    int palette[4][3];
+    From565(color0, palette[0]);
+    From565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        for (int i = 15; i >= 0; i--)
+        {
+            int best = 0, bestDistance = INT32_MAX;
+            for (int p = 0; p < 4; p++)
+            {
+                int distance = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    const int delta = (int)block[i][c] - palette[p][c];
+                    distance += delta * delta;
+                }
+                if (distance < bestDistance)
+                {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices = indices << 2 | best;
+        }
+    }
+
+    std::memcpy(output, &color0, 2);
+    std::memcpy(output + 2, &color1, 2);
+    std::memcpy(output + 4, &indices, 4);
+}
+
+// BC4 block of one channel, in eight value mode unless the block is flat
+void EncodeChannelBlock(const unsigned char block[16][4], const int channel, uint8_t* output)
+{
+    int min = 255, max = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        min = std::min(min, (int)block[i][channel]);
+        max = std::max(max, (int)block[i][channel]);
+    }
+
+    int palette[8] = {max, min};
+    for (int p = 1; p < 7; p++)
+    {
+        palette[p + 1] = ((7 - p) * max + p * min + 3) / 7;
+    }
+
+    uint64_t indices = 0;
+    if (max != min)
+    {
+        for (int i = 15; i >= 0; i--)
+        {
+            int best = 0, bestDistance = 256;
+            for (int p = 0; p < 8; p++)
+            {
+                const int distance = std::abs((int)block[i][channel] - palette[p]);
+                if (distance < bestDistance)
+                {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices = indices << 3 | best;
+        }
+    }
+
+    output[0] = static_cast<uint8_t>(max);
+    output[1] = static_cast<uint8_t>(min);
+    for (int byte = 0; byte < 6; byte++)
+    {
+        output[2 + byte] = static_cast<uint8_t>(indices >> (byte * 8));
+    }
+}
+}
+
+planet::CompressedImage planet::CompressImage(const unsigned char* source, const int resolution, const int faces,
+                                              const int channels, const BlockFormat format, const int channel)
+{
+    CompressedImage output;
+    output.format = format;
+    output.resolution = resolution;
+    output.faces = faces;
+
+    const int blocks = GetBlockCount(resolution);
+    const size_t blockBytes = GetBlockBytes(format);
+    const size_t faceBytes = static_cast<size_t>(blocks) * blocks * blockBytes;
+    const size_t sourceFace = static_cast<size_t>(resolution) * resolution * channels;
+    output.data.resize(faceBytes * faces);
+
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (int face = 0; face < faces; face++)
+    {
+        for (int blockY = 0; blockY < blocks; blockY++)
+        {
+            unsigned char block[16][4];
+            for (int blockX = 0; blockX < blocks; blockX++)
+            {
+                LoadBlock(source + face * sourceFace, resolution, channels, blockX, blockY, block);
+                uint8_t* target = output.data.data() + face * faceBytes + (static_cast<size_t>(blockY) * blocks + blockX) * blockBytes;
+
+                switch (format)
+                {
+                case BlockFormat::BC1:
+                    EncodeColorBlock(block, target);
+                    break;
+                case BlockFormat::BC3:
+                    EncodeChannelBlock(block, 3, target);
+                    EncodeColorBlock(block, target + 8);
+                    break;
+                case BlockFormat::BC4:
+                    EncodeChannelBlock(block, channel, target);
+                    break;
+                case BlockFormat::BC5:
+                    EncodeChannelBlock(block, channel, target);
+                    EncodeChannelBlock(block, channel + 1, target + 8);
+                    break;
+                }
+            }
+        }
+    }
+
+    return output;
+}
@@ -0,0 +1,279 @@
+﻿#include "planetgen/lib/GlbExporter.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <tinygltf/stb_image_write.h>
+
+#include "planetgen/lib/Planet.h"
+#include "planetgen/lib/Profiler.h"
+
+namespace
+{
+constexpr uint32_t GLB_MAGIC = 0x46546C67;      // "glTF"
+constexpr uint32_t GLB_JSON_CHUNK = 0x4E4F534A; // "JSON"
+constexpr uint32_t GLB_BIN_CHUNK = 0x004E4942;  // "BIN\0"
+
+enum ImageMap
+{
+    Albedo,
+    Normal,
+    MetallicRoughness,
+    Emissive,
+};
+
+struct GlbImage
+{
+    const planet::Material* material = nullptr;
+    ImageMap map = Albedo;
+    std::vector<unsigned char> png{};
+};
+
+// A range of the binary chunk, written from `data` when the file is streamed out
+struct GlbView
+{
+    const void* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    int target = 0;     // 0 for image views
+};
+
+size_t Align4(const size_t value) { return (value + 3) & ~static_cast<size_t>(3); }
+
+void AppendPng(void* context, void* data, const int size)
+{
+    auto* png = static_cast<std::vector<unsigned char>*>(context);
+    png->insert(png->end(), static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+}
+
+// The compact maps only become RGBA inside the parallel encode, one texture at a time per thread
+bool EncodePng(GlbImage& image)
+{
+    const planet::Material& material = *image.material;
+    const size_t texels = material.GetTexelCount();
+    std::vector<unsigned char> expanded;
+    const unsigned char* rgba = nullptr;
+    switch (image.map)
+    {
+    case Albedo: rgba = material.albedo.data(); break;
+    case Emissive: rgba = material.GetEmissive().data(); break;
+    case Normal:
+        expanded.resize(texels * 4);
+        planet::ExpandNormals(material.normal.data(), texels, expanded.data());
+        rgba = expanded.data();
+        break;
+    case MetallicRoughness:
+        expanded.resize(texels * 4);
+        planet::ExpandRoughness(material.metallicRoughness.data(), texels, expanded.data());
+        rgba = expanded.data();
+        break;
+    }
+
+    return stbi_write_png_to_func(AppendPng, &image.png, material.resolution, material.resolution, 4, rgba,
+                                  material.resolution * 4) != 0;
+}
+
+void WriteU32(std::ofstream& file, const uint32_t value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+}
+
+bool planet::ExportGlb(const Planet& planet, const std::string& path)
+{
+    PLANET_PROFILE_SCOPE("Export/Glb");
+    struct Layer
+    {
+        const char* name;
+        const Mesh* mesh;
+        const Material* material;
+        bool isBlended;
+        int images[4];  // Image of every ImageMap, -1 when the material lacks it
+    };
+
+    std::vector<Layer> layers{{"Terrain", &planet.GetTerrainMesh(), &planet.GetTerrainMaterial(), false, {}}};
+    // Presets without clouds still fill their maps with zeros, so the preset decides rather than the maps
+    if (planet.GetClouds()->HasNoise())
+    {
+        layers.push_back({"Clouds", &planet.GetCloudMesh(), &planet.GetCloudMaterial(), true, {}});
+    }
+
+    // Every map becomes one image, an emissive map aliasing the albedo reuses the albedo image
+    std::vector<GlbImage> images;
+    for (auto& layer : layers)
+    {
+        const Material& material = *layer.material;
+        if (material.layout != TextureLayout::Equirectangular)
+        {
+            return false;
+        }
+
+        const auto addImage = [&](const ImageMap map, const bool isPresent)
+        {
+            layer.images[map] = isPresent ? static_cast<int>(images.size()) : -1;
+            if (isPresent) images.push_back({&material, map, {}});
+        };
+        addImage(Albedo, !material.albedo.empty());
+        addImage(Normal, !material.normal.empty());
+        addImage(MetallicRoughness, !material.metallicRoughness.empty());
+        if (material.isEmissiveAlbedo)
+        {
+            layer.images[Emissive] = layer.images[Albedo];
+        }
+        else
+        {
+            addImage(Emissive, !material.emissive.empty());
+        }
+    }
+
+    bool isEncoded = true;
+    {
+        PLANET_PROFILE_SCOPE("Export/Png");
+        #pragma omp parallel for schedule(dynamic) reduction(&& : isEncoded)
+        for (int i = 0; i < static_cast<int>(images.size()); i++)
+        {
+            isEncoded = EncodePng(images[i]) && isEncoded;
+        }
+    }
+    if (!isEncoded)
+    {
+        return false;
+    }
+
+    // Lay out the binary chunk: the mesh attributes and indices of every layer, then the images
+    std::vector<GlbView> views;
+    size_t binarySize = 0;
+    const auto addView = [&](const void* data, const size_t size, const int target)
+    {
+        views.push_back({data, size, binarySize, target});
+        binarySize = Align4(binarySize + size);
+        return static_cast<int>(views.size()) - 1;
+    };
+
+    // Bounds are written with enough digits to round trip, viewers reject positions outside them
+    std::ostringstream meshes, accessors, materials, nodes;
+    accessors.precision(9);
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        const Layer& layer = layers[i];
+        const Mesh& mesh = *layer.mesh;
+        const char* separator = i > 0 ? "," : "";
+
+        float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (const glm::vec3& position : mesh.positions)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                min[axis] = std::min(min[axis], position[axis]);
+                max[axis] = std::max(max[axis], position[axis]);
+            }
+        }
+
+        const size_t vertices = mesh.positions.size();
+        const int positions = addView(mesh.positions.data(), vertices * sizeof(glm::vec3), 34962);
+        const int normals = addView(mesh.normals.data(), mesh.normals.size() * sizeof(glm::vec3), 34962);
+        const int uvs = addView(mesh.uvs.data(), mesh.uvs.size() * sizeof(glm::vec2), 34962);
+        const int indices = addView(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), 34963);
+
+        // One accessor per view, so accessor and view indices match
+        accessors << separator
+                  << "{\"bufferView\":" << positions << ",\"componentType\":5126,\"count\":" << vertices
+                  << ",\"type\":\"VEC3\",\"min\":[" << min[0] << "," << min[1] << "," << min[2] << "],\"max\":["
+                  << max[0] << "," << max[1] << "," << max[2] << "]},"
+                  << "{\"bufferView\":" << normals << ",\"componentType\":5126,\"count\":" << mesh.normals.size()
+                  << ",\"type\":\"VEC3\"},"
+                  << "{\"bufferView\":" << uvs << ",\"componentType\":5126,\"count\":" << mesh.uvs.size()
+                  << ",\"type\":\"VEC2\"},"
+                  << "{\"bufferView\":" << indices << ",\"componentType\":5125,\"count\":" << mesh.indices.size()
+                  << ",\"type\":\"SCALAR\"}";
+
+        meshes << separator << "{\"name\":\"" << layer.name << "\",\"primitives\":[{\"attributes\":{\"POSITION\":"
+               << positions << ",\"NORMAL\":" << normals << ",\"TEXCOORD_0\":" << uvs << "},\"indices\":" << indices
+               << ",\"material\":" << i << "}]}";
+
+        materials << separator << "{\"name\":\"" << layer.name << "\",\"pbrMetallicRoughness\":{";
+        if (layer.images[Albedo] >= 0) materials << "\"baseColorTexture\":{\"index\":" << layer.images[Albedo] << "},";
+        if (layer.images[MetallicRoughness] >= 0)
+        {
+            materials << "\"metallicRoughnessTexture\":{\"index\":" << layer.images[MetallicRoughness] << "},";
+        }
+        materials << "\"metallicFactor\":1,\"roughnessFactor\":1}";
+        if (layer.images[Normal] >= 0) materials << ",\"normalTexture\":{\"index\":" << layer.images[Normal] << "}";
+        if (layer.images[Emissive] >= 0)
+        {
+            materials << ",\"emissiveTexture\":{\"index\":" << layer.images[Emissive] << "},\"emissiveFactor\":[1,1,1]";
+        }
+        if (layer.isBlended) materials << ",\"alphaMode\":\"BLEND\"";
+        materials << "}";
+
+        nodes << separator << "{\"name\":\"" << layer.name << "\",\"mesh\":" << i << "}";
+    }
+
+    std::ostringstream imageJson, textures;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const char* separator = i > 0 ? "," : "";
+        const int view = addView(images[i].png.data(), images[i].png.size(), 0);
+        imageJson << separator << "{\"bufferView\":" << view << ",\"mimeType\":\"image/png\"}";
+        textures << separator << "{\"sampler\":0,\"source\":" << i << "}";
+    }
+
+    std::ostringstream viewJson;
+    for (size_t i = 0; i < views.size(); i++)
+    {
+        viewJson << (i > 0 ? "," : "") << "{\"buffer\":0,\"byteOffset\":" << views[i].offset
+                 << ",\"byteLength\":" << views[i].size;
+        if (views[i].target != 0) viewJson << ",\"target\":" << views[i].target;
+        viewJson << "}";
+    }
+
+    std::string scene = "[";
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        scene += (i > 0 ? "," : "") + std::to_string(i);
+    }
+    scene += "]";
+
+    // Longitude wraps around, latitude stops at the poles
+    std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"planetgen\"},\"scene\":0,\"scenes\":[{\"nodes\":" +
+        scene + "}],\"nodes\":[" + nodes.str() + "],\"meshes\":[" + meshes.str() + "],\"materials\":[" +
+        materials.str() + "],\"textures\":[" + textures.str() + "],\"images\":[" + imageJson.str() +
+        "],\"samplers\":[{\"magFilter\":9729,\"minFilter\":9987,\"wrapS\":10497,\"wrapT\":33071}],\"accessors\":[" +
+        accessors.str() + "],\"bufferViews\":[" + viewJson.str() + "],\"buffers\":[{\"byteLength\":" +
+        std::to_string(binarySize) + "}]}";
+    json.resize(Align4(json.size()), ' ');
+
+    const size_t fileSize = 12 + 8 + json.size() + 8 + binarySize;
+    if (fileSize > UINT32_MAX)
+    {
+        return false;
+    }
+
+    PLANET_PROFILE_SCOPE_BYTES("Export/Write", fileSize);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    WriteU32(file, GLB_MAGIC);
+    WriteU32(file, 2);
+    WriteU32(file, static_cast<uint32_t>(fileSize));
+
+    WriteU32(file, static_cast<uint32_t>(json.size()));
+    WriteU32(file, GLB_JSON_CHUNK);
+    file.write(json.data(), static_cast<std::streamsize>(json.size()));
+
+    WriteU32(file, static_cast<uint32_t>(binarySize));
+    WriteU32(file, GLB_BIN_CHUNK);
+    const char padding[4] = {};
+    for (const GlbView& view : views)
+    {
+        file.write(static_cast<const char*>(view.data), static_cast<std::streamsize>(view.size));
+        file.write(padding, static_cast<std::streamsize>(Align4(view.size) - view.size));
+    }
+
+    file.close();
+    return !file.fail();
+}
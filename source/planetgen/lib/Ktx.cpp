@@ -0,0 +1,570 @@
+﻿#include "planetgen/lib/Ktx.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+#include "planetgen/lib/MaterialCache.h"
+#include "planetgen/lib/Mipmap.h"
+#include "planetgen/lib/Profiler.h"
+
+#ifdef PLANETGEN_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+constexpr unsigned char KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+constexpr uint32_t SUPERCOMPRESSION_NONE = 0;
+constexpr uint32_t SUPERCOMPRESSION_ZSTD = 2;
+
+// Data format descriptor values, see the Khronos Data Format Specification
+constexpr uint8_t KHR_DF_MODEL_RGBSDA = 1;
+constexpr uint8_t KHR_DF_MODEL_BC1A = 128;
+constexpr uint8_t KHR_DF_MODEL_BC3 = 130;
+constexpr uint8_t KHR_DF_MODEL_BC4 = 131;
+constexpr uint8_t KHR_DF_MODEL_BC5 = 132;
+constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+constexpr uint8_t KHR_DF_CHANNEL_ALPHA = 15;
+constexpr uint8_t KHR_DF_SAMPLE_LINEAR = 0x10;
+
+struct KtxHeader
+{
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+};
+static_assert(sizeof(KtxHeader) == 52, "KTX2 header must be packed");
+
+// The supercompression global data offset and length follow the header as two 64-bit values, always zero here
+constexpr size_t KTX2_SGD_INDEX_SIZE = 2 * sizeof(uint64_t);
+
+struct KtxLevel
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// How a map is stored: its Vulkan format and what the data format descriptor says about it
+struct KtxFormat
+{
+    uint32_t vkFormat = 0;
+    uint32_t typeSize = 1;
+    uint32_t bytes = 0;         // Per texel, or per 4x4 block for block compressed formats
+    bool isBlock = false;
+    bool isSrgb = false;
+    uint8_t model = KHR_DF_MODEL_RGBSDA;
+    int samples = 0;            // Channels, or BC sub-blocks
+    int sampleBits = 8;
+};
+
+KtxFormat GetRawFormat(const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Albedo:
+    case planet::KtxMap::Emissive: return {43, 1, 4, false, true, KHR_DF_MODEL_RGBSDA, 4, 8};    // R8G8B8A8_SRGB
+    case planet::KtxMap::Normal: return {16, 1, 2, false, false, KHR_DF_MODEL_RGBSDA, 2, 8};     // R8G8_UNORM
+    case planet::KtxMap::MetallicRoughness: return {9, 1, 1, false, false, KHR_DF_MODEL_RGBSDA, 1, 8}; // R8_UNORM
+    case planet::KtxMap::Height: return {70, 2, 2, false, false, KHR_DF_MODEL_RGBSDA, 1, 16};    // R16_UNORM
+    }
+    return {};
+}
+
+KtxFormat GetBlockFormat(const planet::BlockFormat format, const bool isSrgb)
+{
+    switch (format)
+    {
+    case planet::BlockFormat::BC1: return {isSrgb ? 132u : 131u, 1, 8, true, isSrgb, KHR_DF_MODEL_BC1A, 1, 64};
+    case planet::BlockFormat::BC3: return {isSrgb ? 138u : 137u, 1, 16, true, isSrgb, KHR_DF_MODEL_BC3, 2, 64};
+    case planet::BlockFormat::BC4: return {139, 1, 8, true, false, KHR_DF_MODEL_BC4, 1, 64};
+    case planet::BlockFormat::BC5: return {141, 1, 16, true, false, KHR_DF_MODEL_BC5, 2, 64};
+    }
+    return {};
+}
+
+bool IsSrgb(const planet::KtxMap map) { return map == planet::KtxMap::Albedo || map == planet::KtxMap::Emissive; }
+
+// Basic data format descriptor block of one format, including the leading total size
+std::vector<uint32_t> GetDescriptor(const KtxFormat& format)
+{
+    const uint32_t blockSize = 24 + 16 * format.samples;
+    std::vector<uint32_t> words(1 + blockSize / 4, 0);
+    words[0] = 4 + blockSize;
+    words[1] = 0;                           // Khronos vendor, basic descriptor type
+    words[2] = 2 | blockSize << 16;         // Version 1.3
+    words[3] = format.model | KHR_DF_PRIMARIES_BT709 << 8 |
+        (format.isSrgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16;
+    words[4] = format.isBlock ? 3 | 3 << 8 : 0;     // Texel block dimensions minus one
+    words[5] = format.bytes;                        // Bytes in plane 0
+
+    for (int sample = 0; sample < format.samples; sample++)
+    {
+        uint32_t* words4 = &words[7 + sample * 4];
+        uint8_t channel = static_cast<uint8_t>(sample);
+        // BC3 stores the alpha block first, RGBA formats keep alpha in the fourth channel
+        const bool isAlpha = (format.model == KHR_DF_MODEL_BC3 && sample == 0) ||
+            (format.model == KHR_DF_MODEL_RGBSDA && sample == 3);
+        if (format.model == KHR_DF_MODEL_BC3) channel = sample == 0 ? KHR_DF_CHANNEL_ALPHA : 0;
+        if (isAlpha)
+        {
+            channel = KHR_DF_CHANNEL_ALPHA | (format.isSrgb ? KHR_DF_SAMPLE_LINEAR : 0);
+        }
+
+        const uint32_t bitOffset = static_cast<uint32_t>(sample * format.sampleBits);
+        words4[0] = bitOffset | static_cast<uint32_t>(format.sampleBits - 1) << 16 | static_cast<uint32_t>(channel) << 24;
+        words4[1] = 0;  // Sample position
+        words4[2] = 0;  // Lower
+        words4[3] = format.isBlock ? UINT32_MAX : (1u << format.sampleBits) - 1;
+    }
+
+    return words;
+}
+
+const std::vector<unsigned char>* GetRawMap(const planet::Material& material, const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Albedo: return &material.albedo;
+    case planet::KtxMap::Normal: return &material.normal;
+    case planet::KtxMap::MetallicRoughness: return &material.metallicRoughness;
+    case planet::KtxMap::Emissive: return &material.GetEmissive();
+    case planet::KtxMap::Height: return nullptr;
+    }
+    return nullptr;
+}
+
+std::vector<unsigned char>* GetRawMap(planet::Material& material, const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Albedo: return &material.albedo;
+    case planet::KtxMap::Normal: return &material.normal;
+    case planet::KtxMap::MetallicRoughness: return &material.metallicRoughness;
+    case planet::KtxMap::Emissive: return &material.emissive;
+    case planet::KtxMap::Height: return nullptr;
+    }
+    return nullptr;
+}
+
+planet::CompressedImage* GetCompressedMap(planet::Material& material, const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Albedo: return &material.compressed.albedo;
+    case planet::KtxMap::Normal: return &material.compressed.normal;
+    case planet::KtxMap::MetallicRoughness: return &material.compressed.metallicRoughness;
+    case planet::KtxMap::Emissive: return &material.compressed.emissive;
+    case planet::KtxMap::Height: return nullptr;
+    }
+    return nullptr;
+}
+
+int GetChannels(const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Albedo: return planet::Material::albedoChannels;
+    case planet::KtxMap::Normal: return planet::Material::normalChannels;
+    case planet::KtxMap::MetallicRoughness: return planet::Material::metallicRoughnessChannels;
+    case planet::KtxMap::Emissive: return planet::Material::emissiveChannels;
+    case planet::KtxMap::Height: return 2;
+    }
+    return 0;
+}
+
+// One level as it goes into the file, borrowed from the material where possible
+struct LevelData
+{
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    std::vector<unsigned char> storage{};
+
+    void Own(std::vector<unsigned char>&& bytes)
+    {
+        storage = std::move(bytes);
+        data = storage.data();
+        size = storage.size();
+    }
+};
+
+// Raw levels of a map, from the material's mip pyramid while it has one and downsampled here below that
+std::vector<LevelData> GetRawLevels(const planet::Material& material, const planet::KtxMap map)
+{
+    std::vector<LevelData> levels(1);
+    if (map == planet::KtxMap::Height)
+    {
+        levels[0].data = reinterpret_cast<const unsigned char*>(material.height.data());
+        levels[0].size = material.height.size() * sizeof(uint16_t);
+        return levels;
+    }
+
+    const auto* source = GetRawMap(material, map);
+    levels[0].data = source->data();
+    levels[0].size = source->size();
+
+    const int channels = GetChannels(map);
+    const int faces = material.GetFaceCount();
+    int resolution = material.resolution;
+    for (size_t level = 0; resolution > 1; level++)
+    {
+        const int next = planet::GetMipResolution(resolution);
+        const size_t size = static_cast<size_t>(next) * next * faces * channels;
+        const auto* mip = level < material.mips.size() ? GetRawMap(material.mips[level], map) : nullptr;
+
+        LevelData data;
+        if (mip != nullptr && mip->size() == size)
+        {
+            data.data = mip->data();
+            data.size = mip->size();
+        }
+        else
+        {
+            std::vector<unsigned char> bytes(size);
+            planet::Downsample(levels.back().data, resolution, faces, channels, bytes.data(),
+                               map == planet::KtxMap::Normal ? planet::MipFilter::Normal : planet::MipFilter::Box);
+            data.Own(std::move(bytes));
+        }
+
+        levels.push_back(std::move(data));
+        resolution = next;
+    }
+
+    return levels;
+}
+
+// Block format of a map: the one it is already compressed in, otherwise the one Planet would pick for it
+planet::BlockFormat GetMapBlockFormat(const planet::Material& material, const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Normal: return planet::BlockFormat::BC5;
+    case planet::KtxMap::MetallicRoughness: return planet::BlockFormat::BC4;
+    case planet::KtxMap::Emissive: return planet::BlockFormat::BC1;
+    default: break;
+    }
+
+    if (!material.compressed.albedo.IsEmpty())
+    {
+        return material.compressed.albedo.format;
+    }
+
+    // Translucent albedo, like cloud coverage, needs the alpha block
+    for (size_t i = 3; i < material.albedo.size(); i += 4)
+    {
+        if (material.albedo[i] != 255) return planet::BlockFormat::BC3;
+    }
+    return planet::BlockFormat::BC1;
+}
+
+void WriteBytes(std::ofstream& file, const void* data, const size_t size)
+{
+    file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+}
+
+const char* GetMapName(const planet::KtxMap map)
+{
+    switch (map)
+    {
+    case planet::KtxMap::Albedo: return "albedo";
+    case planet::KtxMap::Normal: return "normal";
+    case planet::KtxMap::MetallicRoughness: return "metallicRoughness";
+    case planet::KtxMap::Emissive: return "emissive";
+    case planet::KtxMap::Height: return "height";
+    }
+    return "";
+}
+
+constexpr planet::KtxMap MAPS[] = {planet::KtxMap::Albedo, planet::KtxMap::Normal, planet::KtxMap::MetallicRoughness,
+                                   planet::KtxMap::Emissive, planet::KtxMap::Height};
+}
+
+bool planet::WriteKtx2(const Material& material, const KtxMap map, const std::string& path, const KtxOptions& options)
+{
+#ifndef PLANETGEN_WITH_ZSTD
+    if (options.isSupercompressed)
+    {
+        return false;
+    }
+#endif
+
+    PLANET_PROFILE_SCOPE("Ktx/Write");
+    const bool isBlockCompressed = options.isBlockCompressed && map != KtxMap::Height;
+    auto levels = GetRawLevels(material, map);
+    if (levels[0].size == 0)
+    {
+        return false;
+    }
+
+    KtxFormat format = GetRawFormat(map);
+    if (isBlockCompressed)
+    {
+        const BlockFormat blockFormat = GetMapBlockFormat(material, map);
+        const CompressedImage& existing = map == KtxMap::Albedo ? material.compressed.albedo :
+            map == KtxMap::Normal ? material.compressed.normal :
+            map == KtxMap::MetallicRoughness ? material.compressed.metallicRoughness : material.GetCompressedEmissive();
+        format = GetBlockFormat(blockFormat, IsSrgb(map));
+
+        // Levels are compressed one after the other, CompressImage itself runs in parallel
+        int resolution = material.resolution;
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            if (level == 0 && !existing.IsEmpty() && existing.format == blockFormat)
+            {
+                levels[0].data = existing.data.data();
+                levels[0].size = existing.data.size();
+            }
+            else
+            {
+                auto compressed = CompressImage(levels[level].data, resolution, material.GetFaceCount(), GetChannels(map),
+                                                blockFormat, 0);
+                levels[level].Own(std::move(compressed.data));
+            }
+            resolution = GetMipResolution(resolution);
+        }
+    }
+
+    std::vector<uint64_t> uncompressedSizes(levels.size());
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        uncompressedSizes[level] = levels[level].size;
+    }
+
+#ifdef PLANETGEN_WITH_ZSTD
+    if (options.isSupercompressed)
+    {
+        bool isCompressed = true;
+        #pragma omp parallel for schedule(dynamic) reduction(&& : isCompressed)
+        for (int level = 0; level < static_cast<int>(levels.size()); level++)
+        {
+            std::vector<unsigned char> bytes(ZSTD_compressBound(levels[level].size));
+            const size_t size = ZSTD_compress(bytes.data(), bytes.size(), levels[level].data, levels[level].size,
+                                              options.zstdLevel);
+            isCompressed = !ZSTD_isError(size) && isCompressed;
+            bytes.resize(ZSTD_isError(size) ? 0 : size);
+            levels[level].Own(std::move(bytes));
+        }
+        if (!isCompressed)
+        {
+            return false;
+        }
+    }
+#endif
+
+    // Header, level index and descriptor, then the levels from the smallest up, each aligned to its texel block
+    const auto descriptor = GetDescriptor(format);
+    const uint32_t levelCount = static_cast<uint32_t>(levels.size());
+    const uint32_t dfdOffset = static_cast<uint32_t>(sizeof(KTX2_IDENTIFIER) + sizeof(KtxHeader) + KTX2_SGD_INDEX_SIZE +
+                                                     levelCount * sizeof(KtxLevel));
+    const uint32_t dfdLength = static_cast<uint32_t>(descriptor.size() * sizeof(uint32_t));
+    const uint64_t alignment = options.isSupercompressed ? 1 : std::lcm<uint64_t>(format.bytes, 4);
+
+    std::vector<KtxLevel> index(levelCount);
+    uint64_t offset = dfdOffset + dfdLength;
+    for (uint32_t level = levelCount; level-- > 0;)
+    {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[level] = {offset, levels[level].size, uncompressedSizes[level]};
+        offset += levels[level].size;
+    }
+
+    KtxHeader header{};
+    header.vkFormat = format.vkFormat;
+    header.typeSize = format.typeSize;
+    header.pixelWidth = static_cast<uint32_t>(material.resolution);
+    header.pixelHeight = static_cast<uint32_t>(material.resolution);
+    header.faceCount = static_cast<uint32_t>(material.GetFaceCount());
+    header.levelCount = levelCount;
+    header.supercompressionScheme = options.isSupercompressed ? SUPERCOMPRESSION_ZSTD : SUPERCOMPRESSION_NONE;
+    header.dfdByteOffset = dfdOffset;
+    header.dfdByteLength = dfdLength;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    WriteBytes(file, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    WriteBytes(file, &header, sizeof(header));
+    const uint64_t sgd[2] = {0, 0};
+    WriteBytes(file, sgd, KTX2_SGD_INDEX_SIZE);
+    WriteBytes(file, index.data(), index.size() * sizeof(KtxLevel));
+    WriteBytes(file, descriptor.data(), dfdLength);
+    for (uint32_t level = levelCount; level-- > 0;)
+    {
+        file.seekp(static_cast<std::streamoff>(index[level].byteOffset));
+        WriteBytes(file, levels[level].data, levels[level].size);
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+bool planet::WriteMaterialKtx2(const Material& material, const std::string& prefix, const KtxOptions& options)
+{
+    bool isWritten = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&& : isWritten)
+    for (int i = 0; i < static_cast<int>(std::size(MAPS)); i++)
+    {
+        const KtxMap map = MAPS[i];
+        const bool isPresent = map == KtxMap::Height ? !material.height.empty() : !GetRawMap(material, map)->empty();
+        if (isPresent)
+        {
+            isWritten = WriteKtx2(material, map, prefix + "_" + GetMapName(map) + ".ktx2", options) && isWritten;
+        }
+    }
+
+    return isWritten;
+}
+
+bool planet::ReadKtx2(const std::string& path, const KtxMap map, Material& material)
+{
+    const MappedFile file(path);
+    const size_t headerEnd = sizeof(KTX2_IDENTIFIER) + sizeof(KtxHeader) + KTX2_SGD_INDEX_SIZE;
+    if (!file.IsOpen() || file.GetSize() < headerEnd ||
+        std::memcmp(file.GetData(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+    {
+        return false;
+    }
+
+    PLANET_PROFILE_SCOPE_BYTES("Ktx/Read", file.GetSize());
+    KtxHeader header;
+    std::memcpy(&header, file.GetData() + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+    // Only what WriteKtx2 produces: square 2D textures or cubemaps of a format matching the map
+    const KtxFormat raw = GetRawFormat(map);
+    KtxFormat format = raw;
+    BlockFormat blockFormat = BlockFormat::BC1;
+    bool isBlock = false;
+    for (const BlockFormat candidate : {BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC4, BlockFormat::BC5})
+    {
+        if (map != KtxMap::Height && GetBlockFormat(candidate, IsSrgb(map)).vkFormat == header.vkFormat)
+        {
+            format = GetBlockFormat(candidate, IsSrgb(map));
+            blockFormat = candidate;
+            isBlock = true;
+        }
+    }
+
+    const size_t levelsEnd = headerEnd + static_cast<size_t>(header.levelCount) * sizeof(KtxLevel);
+    if ((!isBlock && header.vkFormat != raw.vkFormat) || header.pixelWidth == 0 || header.pixelWidth != header.pixelHeight ||
+        header.pixelDepth != 0 || header.layerCount > 1 || (header.faceCount != 1 && header.faceCount != 6) ||
+        header.levelCount == 0 || (map == KtxMap::Height && header.levelCount != 1) || levelsEnd > file.GetSize())
+    {
+        return false;
+    }
+#ifndef PLANETGEN_WITH_ZSTD
+    if (header.supercompressionScheme != SUPERCOMPRESSION_NONE)
+    {
+        return false;
+    }
+#else
+    if (header.supercompressionScheme != SUPERCOMPRESSION_NONE && header.supercompressionScheme != SUPERCOMPRESSION_ZSTD)
+    {
+        return false;
+    }
+#endif
+
+    const TextureLayout layout = header.faceCount == 6 ? TextureLayout::Cubemap : TextureLayout::Equirectangular;
+    material.layout = layout;
+    material.resolution = static_cast<int>(header.pixelWidth);
+    if (map != KtxMap::Height)
+    {
+        material.mips.resize(header.levelCount - 1);
+    }
+
+    int resolution = material.resolution;
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        KtxLevel entry;
+        std::memcpy(&entry, file.GetData() + headerEnd + level * sizeof(KtxLevel), sizeof(entry));
+
+        const size_t faces = header.faceCount;
+        const size_t blocks = static_cast<size_t>(GetBlockCount(resolution));
+        const size_t expected = isBlock ? blocks * blocks * faces * format.bytes :
+            static_cast<size_t>(resolution) * resolution * faces * raw.bytes;
+        if (entry.byteOffset + entry.byteLength > file.GetSize() || entry.uncompressedByteLength != expected)
+        {
+            return false;
+        }
+
+        const unsigned char* source = file.GetData() + entry.byteOffset;
+        std::vector<unsigned char> bytes;
+        if (header.supercompressionScheme == SUPERCOMPRESSION_NONE)
+        {
+            if (entry.byteLength != expected)
+            {
+                return false;
+            }
+            bytes.assign(source, source + expected);
+        }
+#ifdef PLANETGEN_WITH_ZSTD
+        else
+        {
+            bytes.resize(expected);
+            const size_t size = ZSTD_decompress(bytes.data(), bytes.size(), source, entry.byteLength);
+            if (ZSTD_isError(size) || size != expected)
+            {
+                return false;
+            }
+        }
+#endif
+
+        Material& target = level == 0 ? material : material.mips[level - 1];
+        target.layout = layout;
+        target.resolution = resolution;
+        if (map == KtxMap::Height)
+        {
+            target.height.resize(expected / sizeof(uint16_t));
+            std::memcpy(target.height.data(), bytes.data(), expected);
+        }
+        else if (isBlock)
+        {
+            *GetCompressedMap(target, map) = CompressedImage{blockFormat, resolution, static_cast<int>(faces), std::move(bytes)};
+        }
+        else
+        {
+            *GetRawMap(target, map) = std::move(bytes);
+        }
+
+        resolution = GetMipResolution(resolution);
+    }
+
+    if (map == KtxMap::Emissive)
+    {
+        material.isEmissiveAlbedo = false;
+    }
+    return true;
+}
+
+bool planet::ReadMaterialKtx2(const std::string& prefix, Material& material)
+{
+    for (const KtxMap map : MAPS)
+    {
+        const std::string path = prefix + "_" + GetMapName(map) + ".ktx2";
+        const bool exists = MappedFile(path).IsOpen();
+        if (map == KtxMap::Albedo && !exists)
+        {
+            return false;
+        }
+        if (exists && !ReadKtx2(path, map, material))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
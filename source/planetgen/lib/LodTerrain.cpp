@@ -0,0 +1,458 @@
+﻿#include "planetgen/lib/LodTerrain.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "planetgen/lib/Planet.h"
+#include "planetgen/lib/Profiler.h"
+#include "planetgen/lib/Sphere.h"
+
+#include "omp.h"
+
+namespace
+{
+// Stitching moves every vertex of an edge between the ones a coarser neighbour shares with it, which only lines up
+// when the quads of an edge halve evenly down to one
+int RoundUpToPowerOfTwo(const int value)
+{
+    int power = 1;
+    while (power < value && power < (1 << 16))
+    {
+        power *= 2;
+    }
+    return power;
+}
+
+// Face coordinate of grid line `index` of a node, out of `lines` per face edge. Computed as one division of exact
+// integers, so every node and face sharing a grid line lands on the same float and the chunks' borders meet exactly.
+float GetFaceCoordinate(const int node, const int quads, const int index, const int level)
+{
+    const double lines = (double)quads * (double)(1ll << level);
+    return (float)((2.0 * ((double)node * quads + index) - lines) / lines);
+}
+
+// Unit sphere direction of a face coordinate, and the point the terrain noise samples for it. The noise is rotated
+// like the equirectangular and cubemap layouts, see Sphere::GetTileCoordinates, so chunks match the planet's maps.
+glm::vec3 GetDirection(const int face, const float s, const float t)
+{
+    return glm::normalize(planet::Sphere::Spherify(planet::Sphere::GetCubePoint(face, s, t)));
+}
+
+void SetNoisePoint(planet::SphericalCoordinates& coords, const size_t index, const glm::vec3 direction)
+{
+    coords.x[index] = -direction.x;
+    coords.y[index] = -direction.z;
+    coords.z[index] = direction.y;
+}
+}
+
+size_t planet::LodChunk::GetBytes() const
+{
+    return (mesh.positions.size() + mesh.normals.size() + basePositions.size()) * sizeof(glm::vec3) +
+        mesh.uvs.size() * sizeof(glm::vec2) + mesh.indices.size() * sizeof(uint32_t) +
+        material.albedo.size() + material.normal.size() + material.metallicRoughness.size();
+}
+
+planet::LodTerrain::LodTerrain(const Planet& planet, const LodConfig& config) : planet(planet), config(config)
+{
+    this->config.maxLevel = std::clamp(config.maxLevel, 0, 24);
+    this->config.chunkQuads = RoundUpToPowerOfTwo(config.chunkQuads);
+    this->config.tileResolution = std::max(config.tileResolution, 1);
+
+    // The generator graph is built lazily, build it here before the workers share it
+    Terrain* terrain = planet.GetTerrain();
+    terrain->GetGeneratorKey();
+
+    // Presets normalizing their noise need its range over the whole sphere, a coarse pass finds it once
+    if (terrain->UsesNoiseRange())
+    {
+        std::vector<float> noise(256 * 256);
+        noiseRange = terrain->GenerateOnPoints(Sphere::GetTileCoordinates(256, 0, 0, 256, 256), noise.data());
+    }
+
+    const int threads = config.threads > 0 ? config.threads : std::max(1, (int)std::thread::hardware_concurrency() / 2);
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back([this]() { Work(); });
+    }
+}
+
+planet::LodTerrain::~LodTerrain()
+{
+    {
+        std::lock_guard lock(mutex);
+        isStopping = true;
+        requests.clear();
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+uint64_t planet::LodTerrain::GetKey(const int face, const int level, const int x, const int y)
+{
+    return (uint64_t)face | (uint64_t)level << 3 | (uint64_t)x << 8 | (uint64_t)y << 33;
+}
+
+size_t planet::LodTerrain::GetPendingCount() const
+{
+    std::lock_guard lock(mutex);
+    return requests.size() + inFlight.size();
+}
+
+const std::vector<const planet::LodChunk*>& planet::LodTerrain::Update(const glm::vec3 camera)
+{
+    PLANET_PROFILE_SCOPE("Lod/Update");
+
+    // Take over what the workers finished since the last frame
+    std::vector<std::unique_ptr<LodChunk>> finished;
+    {
+        std::lock_guard lock(mutex);
+        finished.swap(completed);
+    }
+    for (auto& chunk : finished)
+    {
+        const uint64_t key = GetKey(chunk->face, chunk->level, chunk->x, chunk->y);
+        if (chunkIndex.count(key) == 0)
+        {
+            cachedBytes += chunk->GetBytes();
+            chunks.push_front(std::move(chunk));
+            chunkIndex.emplace(key, chunks.begin());
+        }
+    }
+
+    frame++;
+    selection.clear();
+    std::vector<Request> missing;
+    for (int face = 0; face < 6; face++)
+    {
+        Select(face, 0, 0, 0, camera, missing);
+    }
+
+    // Coarse chunks first, they are the fallback of everything below them, then the closest ones
+    std::sort(missing.begin(), missing.end(), [](const Request& a, const Request& b)
+    {
+        return a.level != b.level ? a.level < b.level : a.distance < b.distance;
+    });
+    {
+        std::lock_guard lock(mutex);
+        missing.erase(std::remove_if(missing.begin(), missing.end(), [this](const Request& request)
+        {
+            return std::find(inFlight.begin(), inFlight.end(), request.key) != inFlight.end();
+        }), missing.end());
+
+        // Requests that are no longer wanted are dropped before they start
+        requests = std::move(missing);
+    }
+    wake.notify_all();
+
+    std::unordered_map<uint64_t, int> selected;
+    selected.reserve(selection.size());
+    for (const LodChunk* chunk : selection)
+    {
+        selected.emplace(GetKey(chunk->face, chunk->level, chunk->x, chunk->y), chunk->level);
+    }
+    for (const auto& [key, level] : selected)
+    {
+        Stitch(**chunkIndex.at(key), selected);
+    }
+
+    Evict();
+    return selection;
+}
+
+bool planet::LodTerrain::Select(const int face, const int level, const int x, const int y, const glm::vec3 camera,
+                                std::vector<Request>& missing)
+{
+    const uint64_t key = GetKey(face, level, x, y);
+    const float span = 2.0f / (float)(1 << level);
+    const float radius = planet.GetConfig()->radius;
+    const glm::vec3 center = GetDirection(face, -1.0f + span * ((float)x + 0.5f), -1.0f + span * ((float)y + 0.5f)) * radius;
+    const float distance = glm::distance(camera, center);
+
+    LodChunk* chunk = nullptr;
+    const auto it = chunkIndex.find(key);
+    if (it != chunkIndex.end())
+    {
+        chunks.splice(chunks.begin(), chunks, it->second);
+        chunk = it->second->get();
+        chunk->lastUsed = frame;
+    }
+    else
+    {
+        missing.push_back({key, face, level, x, y, distance});
+    }
+
+    // Children only replace the node once all four of them can cover their quarter
+    if (level < config.maxLevel && distance < config.splitDistance * span * radius)
+    {
+        const size_t start = selection.size();
+        bool isCovered = true;
+        for (int child = 0; child < 4; child++)
+        {
+            isCovered &= Select(face, level + 1, x * 2 + child % 2, y * 2 + child / 2, camera, missing);
+        }
+        if (isCovered)
+        {
+            return true;
+        }
+
+        selection.resize(start);
+    }
+
+    if (chunk == nullptr)
+    {
+        return false;
+    }
+
+    selection.push_back(chunk);
+    return true;
+}
+
+int planet::LodTerrain::GetSelectedLevel(const glm::vec3 cubePoint, const std::unordered_map<uint64_t, int>& selected) const
+{
+    float s, t;
+    const int face = Sphere::GetCubeFace(cubePoint, s, t);
+    for (int level = 0; level <= config.maxLevel; level++)
+    {
+        const int nodes = 1 << level;
+        const int x = std::clamp((int)((s + 1.0f) * 0.5f * (float)nodes), 0, nodes - 1);
+        const int y = std::clamp((int)((t + 1.0f) * 0.5f * (float)nodes), 0, nodes - 1);
+        if (selected.count(GetKey(face, level, x, y)) != 0)
+        {
+            return level;
+        }
+    }
+
+    return -1;
+}
+
+void planet::LodTerrain::Stitch(LodChunk& chunk, const std::unordered_map<uint64_t, int>& selected) const
+{
+    const int quads = config.chunkQuads;
+    const float span = 2.0f / (float)(1 << chunk.level);
+    const float s0 = -1.0f + span * (float)chunk.x;
+    const float t0 = -1.0f + span * (float)chunk.y;
+
+    // Probes just past the middle of each edge: s = s0, s = s0 + span, t = t0, t = t0 + span
+    const float inset = span * 1e-3f;
+    const glm::vec2 probes[4] = {
+        {s0 - inset, t0 + span * 0.5f},
+        {s0 + span + inset, t0 + span * 0.5f},
+        {s0 + span * 0.5f, t0 - inset},
+        {s0 + span * 0.5f, t0 + span + inset},
+    };
+
+    std::array<int, 4> coarser{};
+    for (int edge = 0; edge < 4; edge++)
+    {
+        const int level = GetSelectedLevel(Sphere::GetCubePoint(chunk.face, probes[edge].x, probes[edge].y), selected);
+        coarser[edge] = level >= 0 ? std::max(chunk.level - level, 0) : 0;
+    }
+    if (coarser == chunk.coarser)
+    {
+        return;
+    }
+
+    // Vertex (i, j) lies at index i * (quads + 1) + j, i along s and j along t
+    chunk.mesh.positions = chunk.basePositions;
+    const auto getIndex = [quads](const int edge, const int k)
+    {
+        switch (edge)
+        {
+        case 0: return k;
+        case 1: return quads * (quads + 1) + k;
+        case 2: return k * (quads + 1);
+        default: return k * (quads + 1) + quads;
+        }
+    };
+
+    // The coarser neighbour's edge vertices coincide with every step-th vertex of this edge, the ones between them
+    // move onto the straight line the neighbour draws between its vertices. Neighbours more levels apart than the
+    // chunk has quads along an edge are only approximated by the line between this edge's corners.
+    for (int edge = 0; edge < 4; edge++)
+    {
+        if (coarser[edge] == 0)
+        {
+            continue;
+        }
+
+        const int step = std::min(1 << std::min(coarser[edge], 30), quads);
+        for (int k = 0; k <= quads; k++)
+        {
+            const int k0 = k / step * step;
+            const int k1 = std::min(k0 + step, quads);
+            if (k == k0)
+            {
+                continue;
+            }
+
+            const float f = (float)(k - k0) / (float)(k1 - k0);
+            const glm::vec3 a = chunk.basePositions[getIndex(edge, k0)];
+            const glm::vec3 b = chunk.basePositions[getIndex(edge, k1)];
+            chunk.mesh.positions[getIndex(edge, k)] = a + (b - a) * f;
+        }
+    }
+
+    chunk.coarser = coarser;
+    chunk.revision++;
+}
+
+void planet::LodTerrain::Evict()
+{
+    // Never the chunks of this frame, they are all at the front
+    while (cachedBytes > config.cacheBudget && !chunks.empty() && chunks.back()->lastUsed != frame)
+    {
+        const LodChunk& chunk = *chunks.back();
+        cachedBytes -= chunk.GetBytes();
+        chunkIndex.erase(GetKey(chunk.face, chunk.level, chunk.x, chunk.y));
+        chunks.pop_back();
+    }
+}
+
+void planet::LodTerrain::Clear()
+{
+    {
+        std::unique_lock lock(mutex);
+        requests.clear();
+        idle.wait(lock, [this]() { return inFlight.empty(); });
+        completed.clear();
+    }
+
+    selection.clear();
+    chunkIndex.clear();
+    chunks.clear();
+    cachedBytes = 0;
+}
+
+void planet::LodTerrain::Work()
+{
+    // Chunks are small, every worker shades its own on one thread instead of nesting a team per chunk
+    omp_set_num_threads(1);
+
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]() { return isStopping || !requests.empty(); });
+        if (isStopping)
+        {
+            return;
+        }
+
+        const Request request = requests.front();
+        requests.erase(requests.begin());
+        inFlight.push_back(request.key);
+
+        lock.unlock();
+        auto chunk = Generate(request);
+        lock.lock();
+
+        completed.push_back(std::move(chunk));
+        inFlight.erase(std::find(inFlight.begin(), inFlight.end(), request.key));
+        if (inFlight.empty())
+        {
+            idle.notify_all();
+        }
+    }
+}
+
+std::unique_ptr<planet::LodChunk> planet::LodTerrain::Generate(const Request& request) const
+{
+    PLANET_PROFILE_SCOPE("Lod/Chunk");
+    auto chunk = std::make_unique<LodChunk>();
+    chunk->face = request.face;
+    chunk->level = request.level;
+    chunk->x = request.x;
+    chunk->y = request.y;
+
+    Terrain* terrain = planet.GetTerrain();
+    const glm::vec3 offset = planet.GetConfig()->offset;
+    const float radius = planet.GetConfig()->radius;
+    const int quads = config.chunkQuads;
+    const int resolution = config.tileResolution;
+
+    // Vertices with a one vertex apron, so the normals along the border see the neighbouring chunk's slope
+    const int edge = quads + 3;
+    SphericalCoordinates coords(edge * edge);
+    std::vector<glm::vec3> directions(coords.x.size());
+    for (int i = -1; i <= quads + 1; i++)
+    {
+        const float s = GetFaceCoordinate(request.x, quads, i, request.level);
+        for (int j = -1; j <= quads + 1; j++)
+        {
+            const size_t index = static_cast<size_t>(i + 1) * edge + (j + 1);
+            directions[index] = GetDirection(request.face, s, GetFaceCoordinate(request.y, quads, j, request.level));
+            SetNoisePoint(coords, index, directions[index]);
+        }
+    }
+
+    std::vector<float> noise(coords.x.size());
+    terrain->GetNoiseTile(offset, coords, noise.data(), noiseRange);
+    std::vector<glm::vec3> positions(coords.x.size());
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        positions[i] = directions[i] * (radius + planet.GetElevation(noise[i]));
+    }
+
+    Mesh& mesh = chunk->mesh;
+    const int verticesPerEdge = quads + 1;
+    mesh.positions.resize((size_t)verticesPerEdge * verticesPerEdge);
+    mesh.normals.resize(mesh.positions.size());
+    mesh.uvs.resize(mesh.positions.size());
+    for (int i = 0; i < verticesPerEdge; i++)
+    {
+        for (int j = 0; j < verticesPerEdge; j++)
+        {
+            const auto at = [&](const int di, const int dj) { return positions[(size_t)(i + 1 + di) * edge + (j + 1 + dj)]; };
+            const size_t index = (size_t)i * verticesPerEdge + j;
+            mesh.positions[index] = at(0, 0);
+            mesh.normals[index] = glm::normalize(glm::cross(at(1, 0) - at(-1, 0), at(0, 1) - at(0, -1)));
+            mesh.uvs[index] = {(float)i / (float)quads, (float)j / (float)quads};
+        }
+    }
+
+    // Same winding as Sphere::Cube, counter-clockwise in (s, t) faces outwards
+    mesh.indices.reserve((size_t)quads * quads * 6);
+    for (int i = 0; i < quads; i++)
+    {
+        for (int j = 0; j < quads; j++)
+        {
+            const uint32_t k00 = (uint32_t)(i * verticesPerEdge + j);
+            const uint32_t k10 = k00 + (uint32_t)verticesPerEdge;
+            const uint32_t k01 = k00 + 1;
+            const uint32_t k11 = k10 + 1;
+            mesh.indices.insert(mesh.indices.end(), {k00, k10, k11, k00, k11, k01});
+        }
+    }
+    chunk->basePositions = mesh.positions;
+
+    // The material tile at texel centers, plus the one texel apron the shading needs. Rows run along t.
+    const int tileEdge = resolution + 2;
+    SphericalCoordinates tileCoords(tileEdge * tileEdge);
+    const float span = 2.0f / (float)(1 << request.level);
+    const float s0 = -1.0f + span * (float)request.x;
+    const float t0 = -1.0f + span * (float)request.y;
+    for (int y = 0; y < tileEdge; y++)
+    {
+        const float t = t0 + span * ((float)(y - 1) + 0.5f) / (float)resolution;
+        for (int x = 0; x < tileEdge; x++)
+        {
+            const float s = s0 + span * ((float)(x - 1) + 0.5f) / (float)resolution;
+            SetNoisePoint(tileCoords, static_cast<size_t>(y) * tileEdge + x, GetDirection(request.face, s, t));
+        }
+    }
+
+    std::vector<float> tileNoise(tileCoords.x.size());
+    terrain->GetNoiseTile(offset, tileCoords, tileNoise.data(), noiseRange);
+
+    // Land normals get the strength of an equirectangular texture of the same texel density
+    const float detail = (float)resolution * (float)(1 << request.level) * 4.0f / 256.0f;
+    const uint32_t stages = StageAlbedo | StageNormal | StageRoughness;
+    chunk->material.resolution = resolution;
+    chunk->material.isEmissiveAlbedo = terrain->IsEmissive();
+    planet.ShadeTile(Layer::Terrain, tileNoise, resolution, resolution, detail, stages, chunk->material);
+
+    return chunk;
+}
@@ -0,0 +1,45 @@
+﻿#include "planetgen/lib/Material.h"
+
+#include <algorithm>
+
+void planet::ExpandNormals(const unsigned char* normals, const size_t texels, unsigned char* output)
+{
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < static_cast<int64_t>(texels); i++)
+    {
+        const float x = (float)normals[i * 2 + 0] / 255.f * 2.0f - 1.0f;
+        const float y = (float)normals[i * 2 + 1] / 255.f * 2.0f - 1.0f;
+        const float z = std::sqrt(std::max(0.0f, 1.0f - x * x - y * y));
+
+        output[i * 4 + 0] = normals[i * 2 + 0];
+        output[i * 4 + 1] = normals[i * 2 + 1];
+        output[i * 4 + 2] = (unsigned char)((z * 0.5f + 0.5f) * 255.f);
+        output[i * 4 + 3] = 255;
+    }
+}
+
+void planet::ExpandRoughness(const unsigned char* roughness, const size_t texels, unsigned char* output)
+{
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < static_cast<int64_t>(texels); i++)
+    {
+        output[i * 4 + 0] = 0;
+        output[i * 4 + 1] = roughness[i];
+        output[i * 4 + 2] = 0;
+        output[i * 4 + 3] = 255;
+    }
+}
+
+std::vector<unsigned char> planet::Material::GetNormalRGBA() const
+{
+    std::vector<unsigned char> output(normal.size() / normalChannels * 4);
+    ExpandNormals(normal.data(), normal.size() / normalChannels, output.data());
+    return output;
+}
+
+std::vector<unsigned char> planet::Material::GetMetallicRoughnessRGBA() const
+{
+    std::vector<unsigned char> output(metallicRoughness.size() / metallicRoughnessChannels * 4);
+    ExpandRoughness(metallicRoughness.data(), metallicRoughness.size() / metallicRoughnessChannels, output.data());
+    return output;
+}
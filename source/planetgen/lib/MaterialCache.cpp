@@ -0,0 +1,408 @@
+﻿#include "planetgen/lib/MaterialCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "planetgen/lib/Profiler.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr char MAGIC[4] = {'P', 'G', 'M', 'C'};
+constexpr uint64_t PAGE_SIZE = 4096;
+
+enum CacheMap : uint32_t
+{
+    Albedo,
+    Emissive,
+    Normal,
+    Occlusion,
+    MetallicRoughness,
+    Height,
+    MapCount,
+};
+
+enum CacheFlags : uint32_t
+{
+    EmissiveAlbedo = 1 << 0,
+};
+
+struct CacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t layout;
+    int32_t resolution;
+    uint32_t flags;
+    uint32_t mapCount;
+    float statsMin;
+    float statsMax;
+    uint64_t checksum;  // Of every map's bytes in file order, catches entries torn by a crashed or racing writer
+};
+
+struct CacheMapEntry
+{
+    uint32_t map;
+    uint32_t reserved;
+    uint64_t offset;    // From the start of the file, a multiple of PAGE_SIZE
+    uint64_t size;      // In bytes
+};
+
+uint64_t AlignUp(const uint64_t value) { return (value + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE; }
+
+// FNV-1a over 64 bit words instead of bytes, fast enough to check a whole entry on every load
+uint64_t Checksum(uint64_t hash, const void* data, const size_t size)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint32_t GetProcessId()
+{
+#ifdef _WIN32
+    return static_cast<uint32_t>(GetCurrentProcessId());
+#else
+    return static_cast<uint32_t>(getpid());
+#endif
+}
+
+std::atomic<uint64_t> temporaryCount{0};
+
+// The maps of a material in file order, as bytes
+std::vector<std::pair<CacheMap, std::pair<const void*, size_t>>> GetMaps(const planet::Material& material)
+{
+    std::vector<std::pair<CacheMap, std::pair<const void*, size_t>>> maps;
+    const auto add = [&maps](const CacheMap map, const void* data, const size_t size)
+    {
+        if (size > 0) maps.push_back({map, {data, size}});
+    };
+    add(Albedo, material.albedo.data(), material.albedo.size());
+    add(Emissive, material.emissive.data(), material.emissive.size());
+    add(Normal, material.normal.data(), material.normal.size());
+    add(Occlusion, material.occlusion.data(), material.occlusion.size());
+    add(MetallicRoughness, material.metallicRoughness.data(), material.metallicRoughness.size());
+    add(Height, material.height.data(), material.height.size() * sizeof(uint16_t));
+    return maps;
+}
+}
+
+planet::MappedFile::MappedFile(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        return;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        return;
+    }
+
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        return;
+    }
+
+    data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    size = data != nullptr ? static_cast<size_t>(fileSize.QuadPart) : 0;
+#else
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return;
+    }
+
+    struct stat status{};
+    if (fstat(file, &status) == 0 && status.st_size > 0)
+    {
+        void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        if (view != MAP_FAILED)
+        {
+            data = static_cast<const unsigned char*>(view);
+            size = static_cast<size_t>(status.st_size);
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(file);
+#endif
+}
+
+planet::MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data != nullptr) UnmapViewOfFile(data);
+    if (mapping != nullptr) CloseHandle(mapping);
+    if (file != nullptr) CloseHandle(file);
+#else
+    if (data != nullptr) munmap(const_cast<unsigned char*>(data), size);
+#endif
+}
+
+planet::MaterialCache::MaterialCache(std::filesystem::path directory) : directory(std::move(directory))
+{
+    std::error_code error;
+    std::filesystem::create_directories(this->directory, error);
+}
+
+std::filesystem::path planet::MaterialCache::GetPath(const uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.pgmc", static_cast<unsigned long long>(key));
+    return directory / name;
+}
+
+bool planet::MaterialCache::Contains(const uint64_t key) const
+{
+    std::error_code error;
+    return std::filesystem::is_regular_file(GetPath(key), error);
+}
+
+std::unique_ptr<planet::MappedFile> planet::MaterialCache::Map(const uint64_t key) const
+{
+    auto file = std::make_unique<MappedFile>(GetPath(key));
+    return file->IsOpen() ? std::move(file) : nullptr;
+}
+
+bool planet::MaterialCache::Load(const uint64_t key, Material& material, HeightfieldStats& stats) const
+{
+    auto file = Map(key);
+    if (!file || file->GetSize() < sizeof(CacheHeader))
+    {
+        return false;
+    }
+
+    PLANET_PROFILE_SCOPE_BYTES("Cache/Load", file->GetSize());
+    CacheHeader header;
+    std::memcpy(&header, file->GetData(), sizeof(header));
+    const size_t tableEnd = sizeof(CacheHeader) + static_cast<size_t>(header.mapCount) * sizeof(CacheMapEntry);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != version || header.key != key ||
+        header.mapCount > MapCount || tableEnd > file->GetSize() || header.resolution <= 0 ||
+        header.layout > static_cast<uint32_t>(TextureLayout::Cubemap))
+    {
+        return false;
+    }
+
+    Material loaded;
+    loaded.layout = static_cast<TextureLayout>(header.layout);
+    loaded.resolution = header.resolution;
+    loaded.isEmissiveAlbedo = (header.flags & EmissiveAlbedo) != 0;
+
+    const size_t texels = loaded.GetTexelCount();
+    uint64_t checksum = Fnv1a{}.hash;
+    for (uint32_t i = 0; i < header.mapCount; i++)
+    {
+        CacheMapEntry entry;
+        std::memcpy(&entry, file->GetData() + sizeof(CacheHeader) + i * sizeof(CacheMapEntry), sizeof(entry));
+        if (entry.offset + entry.size > file->GetSize())
+        {
+            return false;
+        }
+
+        const unsigned char* data = file->GetData() + entry.offset;
+        checksum = Checksum(checksum, data, entry.size);
+        const auto assign = [&](std::vector<unsigned char>& map, const int channels)
+        {
+            map.assign(data, data + entry.size);
+            return entry.size == texels * channels;
+        };
+
+        bool isValid = false;
+        switch (entry.map)
+        {
+        case Albedo: isValid = assign(loaded.albedo, Material::albedoChannels); break;
+        case Emissive: isValid = assign(loaded.emissive, Material::emissiveChannels); break;
+        case Normal: isValid = assign(loaded.normal, Material::normalChannels); break;
+        case Occlusion: isValid = assign(loaded.occlusion, Material::occlusionChannels); break;
+        case MetallicRoughness: isValid = assign(loaded.metallicRoughness, Material::metallicRoughnessChannels); break;
+        case Height:
+            isValid = entry.size == texels * sizeof(uint16_t);
+            if (isValid)
+            {
+                loaded.height.resize(texels);
+                std::memcpy(loaded.height.data(), data, entry.size);
+            }
+            break;
+        default: break;
+        }
+
+        if (!isValid)
+        {
+            return false;
+        }
+    }
+
+    if (checksum != header.checksum)
+    {
+        return false;
+    }
+
+    material = std::move(loaded);
+    stats.min = header.statsMin;
+    stats.max = header.statsMax;
+
+    // Marks the entry as used for Trim(), after unmapping since Windows won't touch a file mapped without write sharing
+    file.reset();
+    std::error_code error;
+    std::filesystem::last_write_time(GetPath(key), std::filesystem::file_time_type::clock::now(), error);
+    return true;
+}
+
+bool planet::MaterialCache::Store(const uint64_t key, const Material& material, const HeightfieldStats& stats) const
+{
+    const auto maps = GetMaps(material);
+
+    CacheHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = version;
+    header.key = key;
+    header.layout = static_cast<uint32_t>(material.layout);
+    header.resolution = material.resolution;
+    header.flags = material.isEmissiveAlbedo ? static_cast<uint32_t>(EmissiveAlbedo) : 0;
+    header.mapCount = static_cast<uint32_t>(maps.size());
+    header.statsMin = stats.min;
+    header.statsMax = stats.max;
+    header.checksum = Fnv1a{}.hash;
+    for (const auto& [map, bytes] : maps)
+    {
+        header.checksum = Checksum(header.checksum, bytes.first, bytes.second);
+    }
+
+    std::vector<CacheMapEntry> entries;
+    uint64_t offset = AlignUp(sizeof(CacheHeader) + maps.size() * sizeof(CacheMapEntry));
+    for (const auto& [map, bytes] : maps)
+    {
+        entries.push_back({map, 0, offset, bytes.second});
+        offset = AlignUp(offset + bytes.second);
+    }
+    PLANET_PROFILE_SCOPE_BYTES("Cache/Store", offset);
+
+    // A name unique to this process, thread and write, so concurrent writers of the same key never share a
+    // temporary file, even across the processes sharing the directory
+    const auto path = GetPath(key);
+    auto temporary = path;
+    temporary += "." + std::to_string(GetProcessId()) + "." +
+        std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "." + std::to_string(temporaryCount++) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(CacheMapEntry)));
+        for (size_t i = 0; i < maps.size(); i++)
+        {
+            file.seekp(static_cast<std::streamoff>(entries[i].offset));
+            file.write(static_cast<const char*>(maps[i].second.first), static_cast<std::streamsize>(maps[i].second.second));
+        }
+
+        // Pad the last map to its page so the file size is a multiple of the page size as well
+        if (!maps.empty() && offset > entries.back().offset + entries.back().size)
+        {
+            file.seekp(static_cast<std::streamoff>(offset - 1));
+            file.put(0);
+        }
+
+        file.close();
+        if (file.fail())
+        {
+            std::error_code error;
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+
+    Trim();
+    return true;
+}
+
+void planet::MaterialCache::Trim() const
+{
+    if (budget == 0)
+    {
+        return;
+    }
+
+    PLANET_PROFILE_SCOPE("Cache/Trim");
+    struct Entry
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code error;
+    for (auto it = std::filesystem::directory_iterator(directory, error); !error && it != std::filesystem::directory_iterator();
+         it.increment(error))
+    {
+        // Temporary files belong to writers still running
+        if (it->path().extension() != ".pgmc")
+        {
+            continue;
+        }
+
+        std::error_code fileError;
+        const uint64_t size = it->file_size(fileError);
+        const auto time = it->last_write_time(fileError);
+        if (!fileError)
+        {
+            entries.push_back({it->path(), time, size});
+            total += size;
+        }
+    }
+
+    // Least recently used first
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+    for (const auto& entry : entries)
+    {
+        if (total <= budget)
+        {
+            break;
+        }
+
+        // Another process may have evicted or replaced it already
+        if (std::filesystem::remove(entry.path, error))
+        {
+            total -= entry.size;
+        }
+    }
+}
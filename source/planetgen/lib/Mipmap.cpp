@@ -0,0 +1,93 @@
+﻿#include "planetgen/lib/Mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace
+{
+float Decode(const unsigned char value) { return (float)value / 255.f * 2.0f - 1.0f; }
+unsigned char Encode(const float value) { return (unsigned char)((value * 0.5f + 0.5f) * 255.f); }
+}
+
+void planet::DownsampleRows(const unsigned char* source, const int resolution, const int faces, const int channels,
+                            unsigned char* output, const MipFilter filter, const int begin, const int end)
+{
+    const int outputResolution = GetMipResolution(resolution);
+    const size_t sourceFace = static_cast<size_t>(resolution) * resolution * channels;
+    const size_t outputFace = static_cast<size_t>(outputResolution) * outputResolution * channels;
+
+    // Every output texel averages a 2x2 block. The last row and column of odd sized images have no block of their
+    // own, so the last output row and column average three source rows and columns instead of dropping them.
+    const auto getTaps = [=](const int index) { return index == outputResolution - 1 ? std::min(resolution - index * 2, 3) : 2; };
+
+    for (int outputRow = begin; outputRow < std::min(end, faces * outputResolution); outputRow++)
+    {
+        const int face = outputRow / outputResolution;
+        const int y = outputRow % outputResolution;
+        const unsigned char* top = source + face * sourceFace + static_cast<size_t>(y * 2) * resolution * channels;
+        const size_t rowStride = static_cast<size_t>(resolution) * channels;
+        const int rows = getTaps(y);
+        unsigned char* row = output + face * outputFace + static_cast<size_t>(y) * outputResolution * channels;
+
+        for (int x = 0; x < outputResolution; x++)
+        {
+            const int left = x * 2 * channels;
+            const int columns = getTaps(x);
+            const int samples = rows * columns;
+            unsigned char* texel = row + x * channels;
+
+            if (filter == MipFilter::Normal && channels >= 2)
+            {
+                // Only x and y are stored, z is rebuilt from the unit length before averaging
+                float nX = 0.0f, nY = 0.0f, nZ = 0.0f;
+                for (int sy = 0; sy < rows; sy++)
+                {
+                    for (int sx = 0; sx < columns; sx++)
+                    {
+                        const unsigned char* sample = top + sy * rowStride + left + sx * channels;
+                        const float dX = Decode(sample[0]);
+                        const float dY = Decode(sample[1]);
+                        nX += dX;
+                        nY += dY;
+                        nZ += std::sqrt(std::max(0.0f, 1.0f - dX * dX - dY * dY));
+                    }
+                }
+
+                const float len = std::sqrt(nX * nX + nY * nY + nZ * nZ);
+                texel[0] = Encode(len > 0.0f ? nX / len : 0.0f);
+                texel[1] = Encode(len > 0.0f ? nY / len : 0.0f);
+                for (int channel = 2; channel < channels; channel++)
+                {
+                    texel[channel] = top[left + channel];
+                }
+                continue;
+            }
+
+            for (int channel = 0; channel < channels; channel++)
+            {
+                int sum = 0;
+                for (int sy = 0; sy < rows; sy++)
+                {
+                    for (int sx = 0; sx < columns; sx++)
+                    {
+                        sum += top[sy * rowStride + left + sx * channels + channel];
+                    }
+                }
+                texel[channel] = static_cast<unsigned char>((sum + samples / 2) / samples);
+            }
+        }
+    }
+}
+
+void planet::Downsample(const unsigned char* source, const int resolution, const int faces, const int channels,
+                        unsigned char* output, const MipFilter filter)
+{
+    const int rows = faces * GetMipResolution(resolution);
+
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < rows; row++)
+    {
+        DownsampleRows(source, resolution, faces, channels, output, filter, row, row + 1);
+    }
+}
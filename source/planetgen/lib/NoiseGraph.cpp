@@ -0,0 +1,198 @@
+﻿#include "planetgen/lib/NoiseGraph.h"
+
+#include <cstdio>
+
+std::mutex planet::NoiseGraph::nodesMutex{};
+std::unordered_map<std::string, FastNoise::SmartNode<>> planet::NoiseGraph::nodes{};
+
+namespace
+{
+// Hex float notation, so parameters that differ in the last bit still get their own node
+std::string Param(const float value)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%a", value);
+    return buffer;
+}
+
+std::string Param(const int value) { return std::to_string(value); }
+std::string Param(const planet::NoiseNode& node) { return node.key; }
+std::string Param(const glm::vec3 value) { return Param(value.x) + "," + Param(value.y) + "," + Param(value.z); }
+
+template<typename... Params>
+std::string Key(const char* name, const Params&... params)
+{
+    std::string key = name;
+    key += '(';
+    ((key += Param(params), key += ';'), ...);
+    key += ')';
+    return key;
+}
+}
+
+// ----------------- SOURCES ----------------- //
+planet::NoiseNode planet::NoiseGraph::Simplex()
+{
+    return Get<FastNoise::Simplex>(Key("Simplex"), [](const auto&) {});
+}
+
+planet::NoiseNode planet::NoiseGraph::OpenSimplex2()
+{
+    return Get<FastNoise::OpenSimplex2>(Key("OpenSimplex2"), [](const auto&) {});
+}
+
+planet::NoiseNode planet::NoiseGraph::Perlin()
+{
+    return Get<FastNoise::Perlin>(Key("Perlin"), [](const auto&) {});
+}
+
+planet::NoiseNode planet::NoiseGraph::Constant(const float value)
+{
+    return Get<FastNoise::Constant>(Key("Constant", value), [&](const auto& node)
+    {
+        node->SetValue(value);
+    });
+}
+
+planet::NoiseNode planet::NoiseGraph::CellularDistance(const float jitterModifier, const FastNoise::CellularDistance::ReturnType returnType)
+{
+    return Get<FastNoise::CellularDistance>(Key("CellularDistance", jitterModifier, static_cast<int>(returnType)), [&](const auto& node)
+    {
+        node->SetJitterModifier(jitterModifier);
+        node->SetReturnType(returnType);
+    });
+}
+
+planet::NoiseNode planet::NoiseGraph::CellularLookup(const NoiseNode& lookup, const float jitterModifier)
+{
+    return Get<FastNoise::CellularLookup>(Key("CellularLookup", lookup, jitterModifier), [&](const auto& node)
+    {
+        node->SetLookup(lookup.generator);
+        node->SetJitterModifier(jitterModifier);
+    }, lookup.isShared);
+}
+
+// ----------------- FRACTALS ----------------- //
+planet::NoiseNode planet::NoiseGraph::FractalFBm(const NoiseNode& source, const float gain, const float weightedStrength, const int octaves, const float lacunarity)
+{
+    return Get<FastNoise::FractalFBm>(Key("FractalFBm", source, gain, weightedStrength, octaves, lacunarity), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetGain(gain);
+        node->SetWeightedStrength(weightedStrength);
+        node->SetOctaveCount(octaves);
+        node->SetLacunarity(lacunarity);
+    }, source.isShared);
+}
+
+planet::NoiseNode planet::NoiseGraph::FractalRidged(const NoiseNode& source, const float gain, const float weightedStrength, const int octaves, const float lacunarity)
+{
+    return Get<FastNoise::FractalRidged>(Key("FractalRidged", source, gain, weightedStrength, octaves, lacunarity), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetGain(gain);
+        node->SetWeightedStrength(weightedStrength);
+        node->SetOctaveCount(octaves);
+        node->SetLacunarity(lacunarity);
+    }, source.isShared);
+}
+
+planet::NoiseNode planet::NoiseGraph::FractalPingPong(const NoiseNode& source, const float gain, const float weightedStrength, const float pingPongStrength, const int octaves, const float lacunarity)
+{
+    return Get<FastNoise::FractalPingPong>(Key("FractalPingPong", source, gain, weightedStrength, pingPongStrength, octaves, lacunarity), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetGain(gain);
+        node->SetWeightedStrength(weightedStrength);
+        node->SetPingPongStrength(pingPongStrength);
+        node->SetOctaveCount(octaves);
+        node->SetLacunarity(lacunarity);
+    }, source.isShared);
+}
+
+// ----------------- DOMAIN ----------------- //
+planet::NoiseNode planet::NoiseGraph::DomainScale(const NoiseNode& source, const float scale)
+{
+    return Get<FastNoise::DomainScale>(Key("DomainScale", source, scale), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetScale(scale);
+    }, source.isShared);
+}
+
+// Axis scale and offset carry a planet's radius and world offset, so they are never shared, see NoiseNode::isShared
+planet::NoiseNode planet::NoiseGraph::DomainAxisScale(const NoiseNode& source, const glm::vec3 scale)
+{
+    return Get<FastNoise::DomainAxisScale>(Key("DomainAxisScale", source, scale), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->template SetScale<FastNoise::Dim::X>(scale.x);
+        node->template SetScale<FastNoise::Dim::Y>(scale.y);
+        node->template SetScale<FastNoise::Dim::Z>(scale.z);
+    }, false);
+}
+
+planet::NoiseNode planet::NoiseGraph::DomainOffset(const NoiseNode& source, const glm::vec3 offset)
+{
+    return Get<FastNoise::DomainOffset>(Key("DomainOffset", source, offset), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->template SetOffset<FastNoise::Dim::X>(offset.x);
+        node->template SetOffset<FastNoise::Dim::Y>(offset.y);
+        node->template SetOffset<FastNoise::Dim::Z>(offset.z);
+    }, false);
+}
+
+planet::NoiseNode planet::NoiseGraph::DomainWarpGradient(const NoiseNode& source, const float warpAmplitude, const float warpFrequency)
+{
+    return Get<FastNoise::DomainWarpGradient>(Key("DomainWarpGradient", source, warpAmplitude, warpFrequency), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetWarpAmplitude(warpAmplitude);
+        node->SetWarpFrequency(warpFrequency);
+    }, source.isShared);
+}
+
+// ----------------- MODIFIERS ----------------- //
+planet::NoiseNode planet::NoiseGraph::Terrace(const NoiseNode& source, const float multiplier, const float smoothness)
+{
+    return Get<FastNoise::Terrace>(Key("Terrace", source, multiplier, smoothness), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetMultiplier(multiplier);
+        node->SetSmoothness(smoothness);
+    }, source.isShared);
+}
+
+planet::NoiseNode planet::NoiseGraph::SeedOffset(const NoiseNode& source, const int offset)
+{
+    return Get<FastNoise::SeedOffset>(Key("SeedOffset", source, offset), [&](const auto& node)
+    {
+        node->SetSource(source.generator);
+        node->SetOffset(offset);
+    }, source.isShared);
+}
+
+planet::NoiseNode planet::NoiseGraph::Max(const NoiseNode& lhs, const NoiseNode& rhs)
+{
+    return Get<FastNoise::Max>(Key("Max", lhs, rhs), [&](const auto& node)
+    {
+        node->SetLHS(lhs.generator);
+        node->SetRHS(rhs.generator);
+    }, lhs.isShared && rhs.isShared);
+}
+
+planet::NoiseNode planet::NoiseGraph::MaxSmooth(const NoiseNode& lhs, const NoiseNode& rhs)
+{
+    return Get<FastNoise::MaxSmooth>(Key("MaxSmooth", lhs, rhs), [&](const auto& node)
+    {
+        node->SetLHS(lhs.generator);
+        node->SetRHS(rhs.generator);
+    }, lhs.isShared && rhs.isShared);
+}
+
+size_t planet::NoiseGraph::GetNodeCount()
+{
+    std::lock_guard lock(nodesMutex);
+    return nodes.size();
+}
@@ -0,0 +1,84 @@
+﻿#include "planetgen/lib/NormalMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Texels per pass, small enough for the scratch rows to stay in L1
+constexpr int CHUNK_SIZE = 256;
+
+float Remap(const float noise) { return (noise + 1.0f) * 0.5f; }
+
+// Copies texels [start - 1, end] of a row into `output`, remapped to [0, 1]. Only the two border texels
+// need the wrap, the interior is a straight vectorizable loop.
+void LoadRow(const float* row, const int width, const bool wrap, const int start, const int end, float* output)
+{
+    output[0] = Remap(start == 0 && wrap ? row[width - 1] : row[start - 1]);
+    output[end - start + 1] = Remap(end == width && wrap ? row[0] : row[end]);
+
+    #pragma omp simd
+    for (int x = start; x < end; x++)
+    {
+        output[x - start + 1] = Remap(row[x]);
+    }
+}
+}
+
+void planet::ComputeNormalRow(const float* top, const float* center, const float* bottom, const int width, const bool wrap,
+                              const NormalStrength& strength, unsigned char* output)
+{
+    // The filter is separable: dX differences the vertical [1 2 1] sums two columns apart and dY differences
+    // the horizontal [1 2 1] sums of the rows above and below. Sums are added in the same order as the full
+    // 3x3 kernel, so the result is bit for bit the same.
+    float t[CHUNK_SIZE + 2];
+    float c[CHUNK_SIZE + 2];
+    float b[CHUNK_SIZE + 2];
+    float columns[CHUNK_SIZE + 2];
+    float dX[CHUNK_SIZE];
+    float dY[CHUNK_SIZE];
+    float lengths[CHUNK_SIZE];
+
+    const float landZ = 1.0f / strength.land;
+    const float waterZ = 1.0f / strength.water;
+
+    for (int start = 0; start < width; start += CHUNK_SIZE)
+    {
+        const int end = std::min(width, start + CHUNK_SIZE);
+        const int count = end - start;
+        LoadRow(top, width, wrap, start, end, t);
+        LoadRow(center, width, wrap, start, end, c);
+        LoadRow(bottom, width, wrap, start, end, b);
+
+        #pragma omp simd
+        for (int i = 0; i < count + 2; i++)
+        {
+            columns[i] = t[i] + 2.0f * c[i] + b[i];
+        }
+
+        #pragma omp simd
+        for (int i = 0; i < count; i++)
+        {
+            dX[i] = -(columns[i + 2] - columns[i]);
+            dY[i] = -((b[i] + 2.0f * b[i + 1] + b[i + 2]) - (t[i] + 2.0f * t[i + 1] + t[i + 2]));
+            const float dZ = c[i + 1] >= strength.threshold ? landZ : waterZ;
+            lengths[i] = dX[i] * dX[i] + dY[i] * dY[i] + dZ * dZ;
+        }
+
+        // Kept apart, with errno handling the square root stays scalar on some compilers and would drag the
+        // rest of the math with it
+        for (int i = 0; i < count; i++)
+        {
+            lengths[i] = std::sqrt(lengths[i]);
+        }
+
+        unsigned char* texel = output + static_cast<size_t>(start) * 2;
+
+        #pragma omp simd
+        for (int i = 0; i < count; i++)
+        {
+            texel[i * 2 + 0] = (unsigned char)((dX[i] / lengths[i] * 0.5f + 0.5f) * 255.f);
+            texel[i * 2 + 1] = (unsigned char)((dY[i] / lengths[i] * 0.5f + 0.5f) * 255.f);
+        }
+    }
+}
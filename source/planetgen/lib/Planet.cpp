@@ -1,15 +1,23 @@
 ﻿#include "planetgen/lib/Planet.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <typeinfo>
+
+#include "planetgen/lib/MaterialCache.h"
+#include "planetgen/lib/NormalMap.h"
+#include "planetgen/lib/Profiler.h"
+
 #include <tinygltf/stb_image_write.h>
 
-#include "math/math.hpp"
 #include "omp.h"
 
-planet::Planet::Planet(Terrain* terrain, Clouds* clouds, MeshConfig* config)
-    : terrain(terrain), clouds(clouds), config(config)
+planet::Planet::Planet(Terrain* terrain, Clouds* clouds, MeshConfig* config, MaterialCache* cache,
+                       const bool isGenerated)
+    : terrain(terrain), clouds(clouds), config(config), materialCache(cache)
 {
-    terrainMesh = Sphere::UV(config->radius, config->stacks, config->sectors, config->inverted);
-    cloudMesh = Sphere::UV(config->radius + 0.05f, config->stacks, config->sectors, config->inverted);
+    RebuildMeshes();
 
     terrain->offset = config->offset;
     terrain->radius = config->radius;
@@ -18,26 +26,89 @@ planet::Planet::Planet(Terrain* terrain, Clouds* clouds, MeshConfig* config)
 
     terrainColorPalette = terrain->GetColors();
     cloudColor = clouds->GetColor();
+    BakeTerrainColors();
+    BakeCloudColors();
 
     // Generate textures...
-    GenerateTerrainMaterial();
-    GenerateCloudsMaterial();
+    if (isGenerated)
+    {
+        RebuildTerrain();
+        RebuildClouds();
+    }
 }
 
-const planet::Material& planet::Planet::GetTerrainMaterial(const std::vector<std::pair<float, glm::vec3>>& colors)
+void planet::Planet::RebuildMeshes()
 {
-    terrainColorPalette = colors;
-    GenerateTerrainMaterial();
+    terrainMesh = Sphere::Create(*config);
+    cloudMesh = Sphere::Create(*config, 0.05f);
+    isTerrainDisplaced = false;
+    terrainUploads |= StageMesh;
+    cloudUploads |= StageMesh;
+    MarkDirty(Layer::Terrain, StageMesh);
+}
 
-    return terrainMaterial;
+void planet::Planet::SetWaterLevel(const float level)
+{
+    if (level == waterLevel)
+    {
+        return;
+    }
+
+    // Water level splits the normal strength and the roughness ramp and is the base of the displacement,
+    // the colors only follow the palette
+    waterLevel = level;
+    MarkDirty(Layer::Terrain, StageNormal | StageRoughness | StageMesh);
 }
-const planet::Material& planet::Planet::GetCloudMaterial(const glm::vec3 color)
+
+void planet::Planet::SetNormalStrength(const float land, const float water)
 {
-    cloudColor = color;
-    GenerateCloudsMaterial();
+    if (land == landNormalStrength && water == waterNormalStrength)
+    {
+        return;
+    }
+
+    landNormalStrength = land;
+    waterNormalStrength = water;
+    MarkDirty(Layer::Terrain, StageNormal);
+}
+
+void planet::Planet::SetDisplacement(const float amplitude)
+{
+    if (amplitude == config->displacement)
+    {
+        return;
+    }
+
+    // Switching displacement on or off adds or drops the height map as well
+    const bool wasDisplaced = config->displacement > 0.0f;
+    config->displacement = amplitude;
+    MarkDirty(Layer::Terrain, wasDisplaced != (amplitude > 0.0f) ? StageMesh | StageHeight : StageMesh);
+}
+
+void planet::Planet::SetTerrainColors(const std::vector<std::pair<float, glm::vec3>>& colors)
+{
+    if (colors == terrainColorPalette)
+    {
+        return;
+    }
+
+    terrainColorPalette = colors;
+    BakeTerrainColors();
+    MarkDirty(Layer::Terrain, StageAlbedo);
+}
 
-    return cloudMaterial;
+void planet::Planet::SetCloudColor(const glm::vec3 color)
+{
+    if (color == cloudColor)
+    {
+        return;
+    }
+
+    cloudColor = color;
+    BakeCloudColors();
+    MarkDirty(Layer::Clouds, StageAlbedo);
 }
+
 void planet::Planet::SetTerrain(Terrain* inTerrain)
 {
     const auto offset = terrain->offset;
@@ -49,8 +120,9 @@ void planet::Planet::SetTerrain(Terrain* inTerrain)
     terrain->radius = radius;
     // terrain->resolution = resolution;
     terrainColorPalette = terrain->GetColors();
+    BakeTerrainColors();
 
-    GenerateTerrainMaterial();
+    MarkDirty(Layer::Terrain, StageNoise);
 }
 void planet::Planet::SetClouds(Clouds* inClouds)
 {
@@ -63,231 +135,1040 @@ void planet::Planet::SetClouds(Clouds* inClouds)
     clouds->radius = radius;
     // clouds->resolution = resolution;
     cloudColor = clouds->GetColor();
+    BakeCloudColors();
 
-    GenerateCloudsMaterial();
+    MarkDirty(Layer::Clouds, StageNoise);
 }
 
-void planet::Planet::GenerateTerrainMaterial()
+void planet::Planet::MarkDirty(const Layer layer, const uint32_t stages)
 {
-    const auto noise = terrain->GetNoiseData(config->offset);
-    terrainMaterial.resolution = terrain->resolution;
+    auto& dirty = layer == Layer::Terrain ? terrainDirty : cloudDirty;
+    dirty |= GetDependentStages(stages);
+}
 
-    std::vector<unsigned char> albedo(terrain->resolution * terrain->resolution * 4);
-    std::vector<unsigned char> normal(terrain->resolution * terrain->resolution * 4);
-    std::vector<unsigned char> OcRoMa(terrain->resolution * terrain->resolution * 4);
-    std::vector<unsigned char> emissive(terrain->resolution * terrain->resolution * 4);
-    
-    #pragma omp parallel for
-    for (size_t i = 0; i < noise.size(); i++)
+void planet::Planet::ForEach(const int count, const std::function<void(int)>& body) const
+{
+    if (parallelFor)
+    {
+        parallelFor(count, body);
+        return;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < count; i++)
+    {
+        body(i);
+    }
+}
+
+uint32_t planet::Planet::GetDependentStages(uint32_t stages)
+{
+    if (stages & StageNoise)
     {
-        float noiseValue = (noise[i] + 1.0f) * 0.5f;
-        glm::vec3 color = GetColorByHeight(noiseValue);
-        albedo[i * 4 + 0] = (unsigned char)(255.f * color.r);
-        albedo[i * 4 + 1] = (unsigned char)(255.f * color.g);
-        albedo[i * 4 + 2] = (unsigned char)(255.f * color.b);
-        albedo[i * 4 + 3] = 255;
+        stages |= StageStats | StageAlbedo | StageNormal | StageRoughness | StageHeight | StageMesh;
+    }
+    if (stages & StageAlbedo)
+    {
+        stages |= StageEmissive;
+    }
+    if (stages & (StageMaps | StageMesh))
+    {
+        stages |= StageUpload;
     }
-    terrainMaterial.albedo = albedo;
 
-    float waterStrength = 3.f;
-    float landStrength = 15.0f;
-    auto height = terrain->resolution;
-    auto width = terrain->resolution;
-    float difference = (float)terrain->resolution / 256.f;
-    #pragma omp parallel for
-    for (int y = 0; y < terrain->resolution; ++y)
+    return stages;
+}
+
+uint32_t planet::Planet::RebuildTerrain()
+{
+    if (!IsNoiseCurrent(terrain, terrainNoise))
     {
-        for (int x = 0; x < terrain->resolution; ++x)
+        MarkDirty(Layer::Terrain, StageNoise);
+    }
+
+    const uint32_t stages = terrainDirty;
+    if (IsCancelled())
+    {
+        return 0;
+    }
+    // Preview steps leave the mesh alone, the final step displaces it once
+    const bool isDisplaced = (stages & StageMesh) && !isPreviewing;
+    if ((stages & StageMaps) && LoadCachedMaterial(Layer::Terrain))
+    {
+        if (isDisplaced)
         {
-            float noiseValue = (noise[y * width + x] + 1.0f) * 0.5f;
-            auto strength = waterStrength;
-            if (noiseValue >= waterLevel)
-            {
-                strength = landStrength * difference;
-            }
+            DisplaceTerrainMesh(true);
+        }
+        return stages & ~StageUpload;
+    }
+    if (isDisplaced)
+    {
+        DisplaceTerrainMesh(!(stages & StageMaps));
+    }
+    if (stages & StageStats)
+    {
+        terrainStats = CalculateStats(GetNoiseField(terrain, terrainNoise));
+    }
+    if (stages & StageMaps)
+    {
+        GenerateTerrainMaterial(stages);
+        // Partially written maps stay dirty and are never uploaded
+        if (IsCancelled())
+        {
+            return 0;
+        }
+        BuildMips(terrainMaterial, stages);
+        CompressMaps(terrainMaterial, stages, BlockFormat::BC1);
+        terrainUploads |= stages & StageMaps;
+        if (stages & StageNoise)
+        {
+            StoreCachedMaterial(Layer::Terrain);
+        }
+    }
 
-            // Use Sobel filter to generate normals from heightmap
-            float tl = (noise[((y - 1 + height) % height) * width + ((x - 1 + width) % width)] + 1.0f) * 0.5f; //top left
-            float t = (noise[((y - 1 + height) % height) * width + (x)] + 1.0f) * 0.5f; //top center
-            float tr = (noise[((y - 1 + height) % height) * width + ((x + 1) % width)] + 1.0f) * 0.5f; //top right
+    TrimNoiseCache();
+    terrainDirty = terrainUploads ? static_cast<uint32_t>(StageUpload) : 0;
+    return stages & ~StageUpload;
+}
 
-            float l = (noise[(y) * width + ((x - 1 + width) % width)] + 1.0f) * 0.5f;// center left
-            float r = (noise[(y) * width + ((x + 1) % width)] + 1.0f) * 0.5f; //center right
+uint32_t planet::Planet::RebuildClouds()
+{
+    if (!IsNoiseCurrent(clouds, cloudNoise))
+    {
+        MarkDirty(Layer::Clouds, StageNoise);
+    }
+
+    const uint32_t stages = cloudDirty;
+    if (IsCancelled())
+    {
+        return 0;
+    }
+    if ((stages & StageMaps) && LoadCachedMaterial(Layer::Clouds))
+    {
+        return stages & ~StageUpload;
+    }
+    if (stages & StageStats)
+    {
+        cloudStats = CalculateStats(GetNoiseField(clouds, cloudNoise));
+    }
+    if (stages & StageMaps)
+    {
+        GenerateCloudsMaterial(stages);
+        // Partially written maps stay dirty and are never uploaded
+        if (IsCancelled())
+        {
+            return 0;
+        }
+        BuildMips(cloudMaterial, stages);
+        CompressMaps(cloudMaterial, stages, BlockFormat::BC3);
+        cloudUploads |= stages & StageMaps;
+        if (stages & StageNoise)
+        {
+            StoreCachedMaterial(Layer::Clouds);
+        }
+    }
 
-            float bl = (noise[((y + 1) % height) * width + ((x - 1 + width) % width)] + 1.0f) * 0.5f; //bottom left
-            float b = (noise[((y + 1) % height) * width + (x)] + 1.0f) * 0.5f; //bottom center
-            float br = (noise[((y + 1) % height) * width + ((x + 1) % width)] + 1.0f) * 0.5f; //bottom right
+    TrimNoiseCache();
+    cloudDirty = cloudUploads ? static_cast<uint32_t>(StageUpload) : 0;
+    return stages & ~StageUpload;
+}
 
-            float dX = -((tr + 2.0f * r + br) - (tl + 2.0f * l + bl));
-            float dY = -((bl + 2.0f * b + br) - (tl + 2.0f * t + tr));
+uint32_t planet::Planet::RebuildProgressive(const Layer layer, const int previewResolution,
+                                           const std::function<void(Material&&)>& onPreview)
+{
+    Texture* texture = layer == Layer::Terrain ? static_cast<Texture*>(terrain) : static_cast<Texture*>(clouds);
+    const auto rebuild = [this, layer]() { return layer == Layer::Terrain ? RebuildTerrain() : RebuildClouds(); };
+    auto& material = layer == Layer::Terrain ? terrainMaterial : cloudMaterial;
+    auto& uploads = layer == Layer::Terrain ? terrainUploads : cloudUploads;
 
-            float dZ = 1.0f / strength;
-            float len = sqrtf(dX * dX + dY * dY + dZ * dZ);
-            dX /= len;
-            dY /= len;
-            dZ /= len;
+    const int resolution = texture->resolution;
+    if (previewResolution <= 0 || previewResolution >= resolution || IsNoiseCurrent(texture, layer == Layer::Terrain ? terrainNoise : cloudNoise) ||
+        (materialCache != nullptr && materialCache->Contains(GetMaterialKey(layer))))
+    {
+        return rebuild();
+    }
 
-            int index = (y * width + x) * 4;
-            normal[index + 0] = (unsigned char)((dX * 0.5f + 0.5f) * 255.f);
-            normal[index + 1] = (unsigned char)((dY * 0.5f + 0.5f) * 255.f);
-            normal[index + 2] = 255;
-            normal[index + 3] = 255;
+    // Every step regenerates the noise, the coordinates of the small steps come from the shared cache
+    for (int step = previewResolution; step < resolution && !IsCancelled(); step *= 2)
+    {
+        texture->resolution = step;
+        isPreviewing = true;
+        rebuild();
+        isPreviewing = false;
+        if (!IsCancelled())
+        {
+            // The moved-out maps are gone, so nothing may be uploaded from the planet until they are rebuilt
+            onPreview(std::move(material));
+            material = Material{};
+            uploads &= ~StageMaps;
+            MarkDirty(layer, StageMaps);
         }
     }
-    terrainMaterial.normal = normal;
 
-    auto map = [](float x, float in_min, float in_max, float out_min, float out_max)
+    texture->resolution = resolution;
+    return rebuild();
+}
+
+uint32_t planet::Planet::TakePendingUploads(const Layer layer)
+{
+    auto& uploads = layer == Layer::Terrain ? terrainUploads : cloudUploads;
+    auto& dirty = layer == Layer::Terrain ? terrainDirty : cloudDirty;
+
+    const uint32_t maps = uploads;
+    uploads = 0;
+    dirty &= ~StageUpload;
+    return maps;
+}
+
+namespace
+{
+// Rows shaded per parallel work item. Three source rows and four output rows of a block stay hot in cache
+// while every map of the material is written in the same sweep.
+constexpr int ROW_BLOCK_SIZE = 16;
+
+float Remap(const float x, const float inMin, const float inMax, const float outMin, const float outMax)
+{
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+unsigned char Roughness(const float height, const float threshold)
+{
+    if (height <= threshold)
     {
-        return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-    };
+        return static_cast<unsigned char>(std::round(Remap(height, 0.0f, threshold, 255.0f, 80.0f)));
+    }
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < noise.size(); i++)
+    return static_cast<unsigned char>(std::round(Remap(height, threshold, 1.0f, 255.0f, 0.0f)));
+}
+}
+
+void planet::Planet::ShadeTerrainRow(const float* top, const float* center, const float* bottom, const int width,
+                                     const bool wrap, const float detail, const uint32_t stages, const MapRows& output) const
+{
+    // Albedo, a gather from the baked palette
+    if (stages & StageAlbedo)
     {
-        // rgb = orm
-        const float value = (noise[i] + 1.0f) * 0.5f;
-        float threshold = waterLevel;
-        unsigned char roughness;
+        #pragma omp simd
+        for (int x = 0; x < width; x++)
+        {
+            const uint32_t color = terrainColorLUT.Sample((center[x] + 1.0f) * 0.5f);
+            std::memcpy(&output.albedo[x * 4], &color, 4);
+        }
+    }
 
-        if (value <= threshold)
+    // Use Sobel filter to generate normals from heightmap
+    if (stages & StageNormal)
+    {
+        const NormalStrength strength{landNormalStrength * detail, waterNormalStrength, waterLevel};
+        ComputeNormalRow(top, center, bottom, width, wrap, strength, output.normal);
+    }
+
+    // Only roughness is stored, occlusion and metallic are constant
+    if (stages & StageRoughness)
+    {
+        for (int x = 0; x < width; x++)
         {
-            roughness = static_cast<unsigned char>(std::round(map(value, 0.0f, threshold, 255.0f, 80.0f)));
+            output.metallicRoughness[x] = Roughness((center[x] + 1.0f) * 0.5f, waterLevel);
         }
-        else
+    }
+
+    if (stages & StageHeight)
+    {
+        #pragma omp simd
+        for (int x = 0; x < width; x++)
         {
-            roughness = static_cast<unsigned char>(std::round(map(value, threshold, 1.0f, 255.0f, 0.0f)));
+            const float height = glm::clamp((center[x] + 1.0f) * 0.5f, 0.0f, 1.0f);
+            output.height[x] = static_cast<uint16_t>(height * 65535.f + 0.5f);
         }
+    }
+    // TODO: Occlusion
+}
 
-        OcRoMa[i * 4 + 0] = 0;
-        OcRoMa[i * 4 + 1] = roughness;
-        OcRoMa[i * 4 + 2] = 0;
-        OcRoMa[i * 4 + 3] = 255;
+void planet::Planet::ShadeCloudRow(const float* top, const float* center, const float* bottom, const int width,
+                                   const bool wrap, const uint32_t stages, const MapRows& output) const
+{
+    const float strength = 3.f;
+    const float threshold = 0.540f;
+
+    // Albedo, a gather from the baked cloud color with the coverage as alpha
+    if (stages & StageAlbedo)
+    {
+        #pragma omp simd
+        for (int x = 0; x < width; x++)
+        {
+            const uint32_t alpha = (unsigned char)(255.f * glm::clamp(center[x], 0.0f, 1.0f));
+            const uint32_t color = (cloudColorLUT.Sample((center[x] + 1.0f) * 0.5f) & 0x00FFFFFFu) | alpha << 24;
+            std::memcpy(&output.albedo[x * 4], &color, 4);
+        }
     }
-    terrainMaterial.metallicRoughness = OcRoMa;
-    if (terrain->IsEmissive())
+
+    // Normal, the same strength above and below the coverage threshold
+    if (stages & StageNormal)
     {
-        terrainMaterial.emissive = albedo;
+        ComputeNormalRow(top, center, bottom, width, wrap, NormalStrength{strength, strength, threshold}, output.normal);
     }
-    else
+
+    // Only roughness is stored, occlusion and metallic are constant
+    if (stages & StageRoughness)
     {
-        terrainMaterial.emissive.clear();
+        for (int x = 0; x < width; x++)
+        {
+            output.metallicRoughness[x] = Roughness((center[x] + 1.0f) * 0.5f, threshold);
+        }
     }
+
+    // TODO: Emissive
     // TODO: Occlusion
 }
 
-void planet::Planet::GenerateCloudsMaterial()
+void planet::Planet::GenerateTerrainMaterial(uint32_t stages)
 {
-    const auto noise = clouds->GetNoiseData(config->offset);
-    std::vector<unsigned char> albedo(clouds->resolution * clouds->resolution * 4);
-    std::vector<unsigned char> normal(clouds->resolution * clouds->resolution * 4);
-    std::vector<unsigned char> OcRoMa(clouds->resolution * clouds->resolution * 4);
-    #pragma omp parallel for
-    for (size_t i = 0; i < noise.size(); i++)
+    const NoiseLayout source = GetNoiseLayout(terrain);
+    const int width = source.width;
+    const int height = source.height;
+    const size_t texels = static_cast<size_t>(width) * height * source.faces;
+    const bool isEmissive = terrain->IsEmissive();
+    if (!isEmissive) stages &= ~StageEmissive;
+    if (!IsHeightKept()) stages &= ~StageHeight;
+    PLANET_PROFILE_SCOPE_BYTES("Terrain/Maps", texels * GetTexelBytes(stages));
+
+    terrainMaterial.layout = terrain->layout;
+    terrainMaterial.resolution = width;
+    if (stages & StageAlbedo) terrainMaterial.albedo.resize(texels * Material::albedoChannels);
+    if (stages & StageNormal) terrainMaterial.normal.resize(texels * Material::normalChannels);
+    if (stages & StageRoughness) terrainMaterial.metallicRoughness.resize(texels * Material::metallicRoughnessChannels);
+    if (stages & StageHeight) terrainMaterial.height.resize(texels);
+
+    // Emissive terrain glows in its own colors, so the emissive map is the albedo rather than a copy of it
+    terrainMaterial.isEmissiveAlbedo = isEmissive;
+    terrainMaterial.emissive = {};
+    if (!IsHeightKept()) terrainMaterial.height = {};
+
+    // Toggling emissive alone touches no texel, and must not pull in noise the cache already dropped
+    if (!(stages & (StageAlbedo | StageNormal | StageRoughness | StageHeight)))
     {
-        const float height = (noise[i] + 1.0f) * 0.5f;
-        auto color = GetCloudColorByHeight(height);
+        return;
+    }
+
+    const auto& noise = GetNoiseField(terrain, terrainNoise);
 
-        albedo[i * 4 + 0] = (unsigned char)(255.f * color.r);
-        albedo[i * 4 + 1] = (unsigned char)(255.f * color.g);
-        albedo[i * 4 + 2] = (unsigned char)(255.f * color.b);
-        albedo[i * 4 + 3] = (unsigned char)(255.f * glm::clamp(noise[i], 0.0f, 1.0f));
+    const float detail = (float)terrain->resolution / 256.f;
+    const int blocks = (height + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE;
+
+    // All dirty maps are produced in a single sweep over blocks of rows,
+    // so every noise texel is only streamed in from memory once.
+    ForEach(blocks * source.faces, [&](const int faceBlock)
+    {
+        if (IsCancelled())
+        {
+            return;
+        }
+
+        const int face = faceBlock / blocks;
+        const int block = faceBlock % blocks;
+        const int yEnd = std::min(height, (block + 1) * ROW_BLOCK_SIZE);
+        for (int y = block * ROW_BLOCK_SIZE; y < yEnd; y++)
+        {
+            const size_t row = (static_cast<size_t>(face) * height + y) * width;
+            const MapRows output = GetMapRows(terrainMaterial, row, stages);
+            ShadeTerrainRow(source.GetRow(noise, face, y - 1), source.GetRow(noise, face, y), source.GetRow(noise, face, y + 1),
+                            width, source.wrap, detail, stages, output);
+        }
+    });
+}
+
+void planet::Planet::GenerateCloudsMaterial(uint32_t stages)
+{
+    const auto& noise = GetNoiseField(clouds, cloudNoise);
+    const NoiseLayout source = GetNoiseLayout(clouds);
+    const int width = source.width;
+    const int height = source.height;
+    const size_t texels = static_cast<size_t>(width) * height * source.faces;
+    stages &= ~StageHeight;
+    PLANET_PROFILE_SCOPE_BYTES("Clouds/Maps", texels * GetTexelBytes(stages));
+
+    cloudMaterial.layout = clouds->layout;
+    cloudMaterial.resolution = width;
+
+    // Presets without clouds still get fully transparent albedo and ORM maps, but no normal map
+    if (noise.empty())
+    {
+        if (stages & StageAlbedo) cloudMaterial.albedo.assign(texels * Material::albedoChannels, 0);
+        if (stages & StageRoughness) cloudMaterial.metallicRoughness.assign(texels * Material::metallicRoughnessChannels, 0);
+        if (stages & StageNormal) cloudMaterial.normal.clear();
+        return;
     }
 
-    cloudMaterial.resolution = clouds->resolution;
-    cloudMaterial.albedo = albedo;
+    if (stages & StageAlbedo) cloudMaterial.albedo.resize(texels * Material::albedoChannels);
+    if (stages & StageNormal) cloudMaterial.normal.resize(texels * Material::normalChannels);
+    if (stages & StageRoughness) cloudMaterial.metallicRoughness.resize(texels * Material::metallicRoughnessChannels);
+
+    const int blocks = (height + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE;
 
-    auto map = [](float x, float in_min, float in_max, float out_min, float out_max)
+    ForEach(blocks * source.faces, [&](const int faceBlock)
     {
-        return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+        if (IsCancelled())
+        {
+            return;
+        }
+
+        const int face = faceBlock / blocks;
+        const int block = faceBlock % blocks;
+        const int yEnd = std::min(height, (block + 1) * ROW_BLOCK_SIZE);
+        for (int y = block * ROW_BLOCK_SIZE; y < yEnd; y++)
+        {
+            const size_t row = (static_cast<size_t>(face) * height + y) * width;
+            const MapRows output = GetMapRows(cloudMaterial, row, stages);
+            ShadeCloudRow(source.GetRow(noise, face, y - 1), source.GetRow(noise, face, y), source.GetRow(noise, face, y + 1),
+                          width, source.wrap, stages, output);
+        }
+    });
+}
+
+void planet::Planet::SetMipmapped(const bool mipmapped)
+{
+    if (mipmapped == isMipmapped)
+    {
+        return;
+    }
+
+    isMipmapped = mipmapped;
+    MarkDirty(Layer::Terrain, StageMaps);
+    MarkDirty(Layer::Clouds, StageMaps);
+}
+
+void planet::Planet::BuildMips(Material& material, const uint32_t stages) const
+{
+    if (!isMipmapped)
+    {
+        material.mips.clear();
+        return;
+    }
+
+    PLANET_PROFILE_SCOPE("Mips");
+    int levels = 0;
+    for (int resolution = material.resolution; resolution > 1; resolution = GetMipResolution(resolution))
+    {
+        levels++;
+    }
+    material.mips.resize(levels);
+
+    struct MipMap
+    {
+        RebuildStage stage;
+        std::vector<unsigned char> Material::* map;
+        int channels;
+    };
+    const MipMap maps[] = {
+        {StageAlbedo, &Material::albedo, Material::albedoChannels},
+        {StageNormal, &Material::normal, Material::normalChannels},
+        {StageRoughness, &Material::metallicRoughness, Material::metallicRoughnessChannels},
+        {StageEmissive, &Material::emissive, Material::emissiveChannels},
     };
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < noise.size(); i++)
+    // Levels are built from the one above, which the loop has just finished. Within a level every map is split into
+    // blocks of rows, so even the first level of a single map spreads over all threads.
+    const Material* previous = &material;
+    for (auto& mip : material.mips)
+    {
+        mip.layout = material.layout;
+        mip.isEmissiveAlbedo = material.isEmissiveAlbedo;
+        mip.resolution = GetMipResolution(previous->resolution);
+
+        std::vector<const MipMap*> dirtyMaps;
+        for (const auto& entry : maps)
+        {
+            const size_t size = mip.GetTexelCount() * entry.channels;
+            const auto& source = previous->*entry.map;
+            auto& output = mip.*entry.map;
+            if (source.empty())
+            {
+                output.clear();
+            }
+            else if ((stages & entry.stage) || output.size() != size)
+            {
+                output.resize(size);
+                dirtyMaps.push_back(&entry);
+            }
+        }
+
+        const int blocks = (mip.GetFaceCount() * mip.resolution + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE;
+        ForEach(static_cast<int>(dirtyMaps.size()) * blocks, [&](const int item)
+        {
+            const MipMap& entry = *dirtyMaps[item / blocks];
+            const int begin = item % blocks * ROW_BLOCK_SIZE;
+            DownsampleRows((previous->*entry.map).data(), previous->resolution, previous->GetFaceCount(), entry.channels,
+                           (mip.*entry.map).data(), entry.stage == StageNormal ? MipFilter::Normal : MipFilter::Box,
+                           begin, begin + ROW_BLOCK_SIZE);
+        });
+
+        previous = &mip;
+    }
+}
+
+void planet::Planet::SetCompressed(const bool compressed)
+{
+    if (compressed == isCompressed)
+    {
+        return;
+    }
+
+    isCompressed = compressed;
+    MarkDirty(Layer::Terrain, StageMaps);
+    MarkDirty(Layer::Clouds, StageMaps);
+}
+
+void planet::Planet::CompressMaps(Material& material, const uint32_t stages, const BlockFormat albedoFormat) const
+{
+    if (!isCompressed)
+    {
+        material.compressed = {};
+        return;
+    }
+
+    PLANET_PROFILE_SCOPE("Compress");
+    const auto compress = [&material](const std::vector<unsigned char>& map, const int channels, const BlockFormat format)
+    {
+        if (map.empty())
+        {
+            return CompressedImage{};
+        }
+
+        return CompressImage(map.data(), material.resolution, material.GetFaceCount(), channels, format, 0);
+    };
+
+    struct CompressJob
+    {
+        RebuildStage stage;
+        const std::vector<unsigned char>* map;
+        int channels;
+        BlockFormat format;
+        CompressedImage* output;
+    };
+    // Aliased emissive maps share the compressed albedo, see Material::GetCompressedEmissive
+    const CompressJob jobs[] = {
+        {StageAlbedo, &material.albedo, Material::albedoChannels, albedoFormat, &material.compressed.albedo},
+        {StageNormal, &material.normal, Material::normalChannels, BlockFormat::BC5, &material.compressed.normal},
+        {StageRoughness, &material.metallicRoughness, Material::metallicRoughnessChannels, BlockFormat::BC4,
+         &material.compressed.metallicRoughness},
+        {StageEmissive, &material.emissive, Material::emissiveChannels, BlockFormat::BC1, &material.compressed.emissive},
+    };
+
+    // The maps don't depend on each other, so each one is an item of its own
+    ForEach(static_cast<int>(std::size(jobs)), [&](const int i)
+    {
+        const CompressJob& job = jobs[i];
+        if (stages & job.stage)
+        {
+            *job.output = compress(*job.map, job.channels, job.format);
+        }
+    });
+}
+
+float planet::Planet::GetElevation(const float noise) const
+{
+    // Water is flat at the sphere's radius, land rises up to the displacement times the radius
+    const float height = glm::clamp((noise + 1.0f) * 0.5f, 0.0f, 1.0f);
+    const float land = std::max(height - waterLevel, 0.0f) / std::max(1.0f - waterLevel, 1e-6f);
+    return land * config->displacement * config->radius;
+}
+
+void planet::Planet::DisplaceTerrainMesh(const bool isMaterialCurrent)
+{
+    const float amplitude = config->displacement;
+    if (amplitude <= 0.0f && !isTerrainDisplaced)
+    {
+        return;
+    }
+
+    terrainMesh = Sphere::Create(*config);
+    isTerrainDisplaced = amplitude > 0.0f;
+    terrainUploads |= StageMesh;
+    if (!isTerrainDisplaced)
+    {
+        return;
+    }
+
+    // Heights come from the noise kept for the maps, then the height map, and only without either from fresh noise
+    const bool isNoiseKept = IsNoiseCurrent(terrain, terrainNoise) && !terrainNoise.data.empty();
+    const std::vector<float> heights = !isNoiseKept && isMaterialCurrent ? GetHeightNoise() : std::vector<float>{};
+    const auto& noise = heights.empty() ? GetNoiseField(terrain, terrainNoise) : heights;
+    const NoiseLayout source = GetNoiseLayout(terrain);
+    PLANET_PROFILE_SCOPE("Terrain/Displace");
+    const std::vector<uint32_t> shared = Sphere::GetSharedVertices(terrainMesh);
+    const size_t vertexCount = terrainMesh.positions.size();
+
+    // Copies of a vertex take the height of the first one, so seams and poles stay closed
+    constexpr size_t VERTEX_BLOCK_SIZE = 4096;
+    const int blocks = static_cast<int>((vertexCount + VERTEX_BLOCK_SIZE - 1) / VERTEX_BLOCK_SIZE);
+    std::vector<float> offsets(vertexCount);
+    ForEach(blocks, [&](const int block)
+    {
+        const size_t end = std::min(vertexCount, (block + 1) * VERTEX_BLOCK_SIZE);
+        for (size_t vertex = block * VERTEX_BLOCK_SIZE; vertex < end; vertex++)
+        {
+            if (shared[vertex] == vertex)
+            {
+                offsets[vertex] = GetElevation(source.Sample(noise, terrainMesh.uvs[vertex]));
+            }
+        }
+    });
+
+    ForEach(blocks, [&](const int block)
+    {
+        const size_t end = std::min(vertexCount, (block + 1) * VERTEX_BLOCK_SIZE);
+        for (size_t vertex = block * VERTEX_BLOCK_SIZE; vertex < end; vertex++)
+        {
+            const glm::vec3 position = terrainMesh.positions[vertex];
+            terrainMesh.positions[vertex] = position + glm::normalize(position) * offsets[shared[vertex]];
+        }
+    });
+
+    Sphere::CalculateNormals(terrainMesh, shared);
+}
+
+void planet::Planet::SetHeightStored(const bool stored)
+{
+    if (stored == isHeightStored)
     {
-        // rgb = orm
-        const float height = (noise[i] + 1.0f) * 0.5f;
-        float threshold = 0.540f;
-        unsigned char roughness;
+        return;
+    }
+
+    isHeightStored = stored;
+    MarkDirty(Layer::Terrain, StageHeight);
+}
+
+size_t planet::Planet::GetTexelBytes(const uint32_t stages)
+{
+    size_t bytes = 0;
+    if (stages & StageAlbedo) bytes += Material::albedoChannels;
+    if (stages & StageNormal) bytes += Material::normalChannels;
+    if (stages & StageRoughness) bytes += Material::metallicRoughnessChannels;
+    if (stages & StageHeight) bytes += sizeof(uint16_t);
+    return bytes;
+}
+
+planet::Planet::MapRows planet::Planet::GetMapRows(Material& material, const size_t texel, const uint32_t stages)
+{
+    MapRows rows;
+    if (stages & StageAlbedo) rows.albedo = material.albedo.data() + texel * Material::albedoChannels;
+    if (stages & StageNormal) rows.normal = material.normal.data() + texel * Material::normalChannels;
+    if (stages & StageRoughness)
+    {
+        rows.metallicRoughness = material.metallicRoughness.data() + texel * Material::metallicRoughnessChannels;
+    }
+    if (stages & StageHeight) rows.height = material.height.data() + texel;
+    return rows;
+}
+
+void planet::Planet::ShadeTile(const Layer layer, const std::vector<float>& noise, const int width, const int height,
+                               const float detail, const uint32_t stages, Material& tile) const
+{
+    NoiseLayout source;
+    source.width = width;
+    source.height = height;
+    source.stride = width + 2;
+    source.wrap = false;
+
+    const size_t texels = static_cast<size_t>(width) * height;
+    if (stages & StageAlbedo) tile.albedo.resize(texels * Material::albedoChannels);
+    if (stages & StageNormal) tile.normal.resize(texels * Material::normalChannels);
+    if (stages & StageRoughness) tile.metallicRoughness.resize(texels * Material::metallicRoughnessChannels);
 
-        if (height <= threshold)
+    #pragma omp parallel for schedule(dynamic, ROW_BLOCK_SIZE)
+    for (int row = 0; row < height; row++)
+    {
+        const MapRows output = GetMapRows(tile, static_cast<size_t>(row) * width, stages & ~StageHeight);
+        const float* top = source.GetRow(noise, 0, row - 1);
+        const float* center = source.GetRow(noise, 0, row);
+        const float* bottom = source.GetRow(noise, 0, row + 1);
+        if (layer == Layer::Terrain)
         {
-            roughness = static_cast<unsigned char>(std::round(map(height, 0.0f, threshold, 255.0f, 80.0f)));
+            ShadeTerrainRow(top, center, bottom, width, false, detail, stages & ~StageHeight, output);
         }
         else
         {
-            roughness = static_cast<unsigned char>(std::round(map(height, threshold, 1.0f, 255.0f, 0.0f)));
+            ShadeCloudRow(top, center, bottom, width, false, stages & ~StageHeight, output);
+        }
+    }
+}
+
+bool planet::Planet::GenerateTiled(const Layer layer, const int resolution, TileSink& sink, const int tileSize)
+{
+    Texture* texture = layer == Layer::Terrain ? static_cast<Texture*>(terrain) : static_cast<Texture*>(clouds);
+    const uint32_t maps = StageMaps & ~StageHeight;
+    const uint32_t stages = layer == Layer::Terrain && terrain->IsEmissive() ? maps : maps & ~StageEmissive;
+    const float detail = (float)resolution / 256.f;
+
+    // Presets normalizing their noise need its range over the whole sphere first, found tile by tile as well
+    FastNoise::OutputMinMax range;
+    std::vector<float> noise;
+    if (texture->UsesNoiseRange())
+    {
+        for (int y = 0; y < resolution; y += tileSize)
+        {
+            for (int x = 0; x < resolution; x += tileSize)
+            {
+                if (IsCancelled())
+                {
+                    return false;
+                }
+
+                const auto coords = Sphere::GetTileCoordinates(resolution, x, y, std::min(tileSize, resolution - x),
+                                                               std::min(tileSize, resolution - y));
+                noise.resize(coords.x.size());
+                range << texture->GenerateOnPoints(coords, noise.data());
+            }
         }
+    }
+
+    Material tile;
+    sink.Begin(resolution, resolution);
+    for (int y = 0; y < resolution; y += tileSize)
+    {
+        for (int x = 0; x < resolution; x += tileSize)
+        {
+            if (IsCancelled())
+            {
+                sink.End();
+                return false;
+            }
+
+            const int width = std::min(tileSize, resolution - x);
+            const int height = std::min(tileSize, resolution - y);
+            PLANET_PROFILE_SCOPE_BYTES("Tiled/Tile", static_cast<size_t>(width) * height * GetTexelBytes(stages));
+
+            // The tile plus a one texel apron for the Sobel filter, wrapping around the texture borders
+            const auto coords = Sphere::GetTileCoordinates(resolution, x - 1, y - 1, width + 2, height + 2);
+            noise.resize(coords.x.size());
+            if (!texture->GetNoiseTile(config->offset, coords, noise.data(), range))
+            {
+                // Layers without noise have no maps to write
+                sink.End();
+                return true;
+            }
 
-        OcRoMa[i * 4 + 0] = 0;
-        OcRoMa[i * 4 + 1] = roughness;
-        OcRoMa[i * 4 + 2] = 0;
-        OcRoMa[i * 4 + 3] = 255;
+            ShadeTile(layer, noise, width, height, detail, stages, tile);
+
+            MaterialTile output;
+            output.x = x;
+            output.y = y;
+            output.width = width;
+            output.height = height;
+            output.albedo = tile.albedo.data();
+            output.normal = tile.normal.data();
+            output.metallicRoughness = tile.metallicRoughness.data();
+            output.emissive = stages & StageEmissive ? tile.albedo.data() : nullptr;
+            sink.Write(output);
+        }
     }
-    cloudMaterial.metallicRoughness = OcRoMa;
+    sink.End();
+    return true;
+}
 
-    if (noise.empty())
+uint64_t planet::Planet::GetMaterialKey(const Layer layer) const
+{
+    Texture* texture = layer == Layer::Terrain ? static_cast<Texture*>(terrain) : static_cast<Texture*>(clouds);
+
+    Fnv1a key;
+    key.Add(static_cast<int>(MaterialCache::version));
+    key.Add(static_cast<int>(layer));
+    key.Add(std::string(typeid(*texture).name()) + ":" + texture->GetGeneratorKey());
+    key.Add(texture->seed);
+    key.Add(texture->resolution);
+    key.Add(static_cast<int>(texture->layout));
+    key.Add(texture->radius);
+    key.Add(config->offset);
+
+    if (layer == Layer::Terrain)
+    {
+        for (const auto& [height, color] : terrainColorPalette)
+        {
+            key.Add(height);
+            key.Add(color);
+        }
+        key.Add(waterLevel);
+        key.Add(landNormalStrength);
+        key.Add(waterNormalStrength);
+        key.Add(static_cast<int>(terrain->IsEmissive()));
+        key.Add(static_cast<int>(IsHeightKept()));
+    }
+    else
+    {
+        key.Add(cloudColor);
+    }
+
+    return key.hash;
+}
+
+bool planet::Planet::LoadCachedMaterial(const Layer layer)
+{
+    if (materialCache == nullptr || isPreviewing)
+    {
+        return false;
+    }
+
+    auto& material = layer == Layer::Terrain ? terrainMaterial : cloudMaterial;
+    auto& stats = layer == Layer::Terrain ? terrainStats : cloudStats;
+    if (!materialCache->Load(GetMaterialKey(layer), material, stats))
+    {
+        return false;
+    }
+
+    // The noise stays as it was, the next shading change regenerates it if it no longer matches
+    BuildMips(material, StageMaps);
+    CompressMaps(material, StageMaps, layer == Layer::Terrain ? BlockFormat::BC1 : BlockFormat::BC3);
+    auto& uploads = layer == Layer::Terrain ? terrainUploads : cloudUploads;
+    auto& dirty = layer == Layer::Terrain ? terrainDirty : cloudDirty;
+    uploads |= StageMaps;
+    dirty = StageUpload;
+    return true;
+}
+
+void planet::Planet::StoreCachedMaterial(const Layer layer)
+{
+    if (materialCache == nullptr || isPreviewing)
     {
-        cloudMaterial.normal.clear();
         return;
     }
 
-    int height = clouds->resolution;
-    int width = clouds->resolution;
-    float strength = 3.f;
+    // Only the maps the cache stores, the next rebuild may write the planet's own material while this one is written
+    const Material& source = layer == Layer::Terrain ? terrainMaterial : cloudMaterial;
+    Material copy;
+    copy.layout = source.layout;
+    copy.resolution = source.resolution;
+    copy.isEmissiveAlbedo = source.isEmissiveAlbedo;
+    copy.albedo = source.albedo;
+    copy.emissive = source.emissive;
+    copy.normal = source.normal;
+    copy.occlusion = source.occlusion;
+    copy.metallicRoughness = source.metallicRoughness;
+    copy.height = source.height;
 
-    #pragma omp parallel for
-    for (int y = 0; y < clouds->resolution; ++y)
+    cacheWrites.erase(std::remove_if(cacheWrites.begin(), cacheWrites.end(), [](const std::future<bool>& write)
     {
-        for (int x = 0; x < clouds->resolution; ++x)
+        return write.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), cacheWrites.end());
+    cacheWrites.push_back(std::async(std::launch::async,
+        [cache = materialCache, key = GetMaterialKey(layer), material = std::move(copy),
+         stats = layer == Layer::Terrain ? terrainStats : cloudStats]()
         {
-            float tl = (noise[((y - 1 + height) % height) * width + ((x - 1 + width) % width)] + 1.0f) * 0.5f; //top left
-            float t = (noise[((y - 1 + height) % height) * width + (x)] + 1.0f) * 0.5f; //top center
-            float tr = (noise[((y - 1 + height) % height) * width + ((x + 1) % width)] + 1.0f) * 0.5f; //top right
-
-            float l = (noise[(y) * width + ((x - 1 + width) % width)] + 1.0f) * 0.5f;// center left
-            float r = (noise[(y) * width + ((x + 1) % width)] + 1.0f) * 0.5f; //center right
-
-            float bl = (noise[((y + 1) % height) * width + ((x - 1 + width) % width)] + 1.0f) * 0.5f; //bottom left
-            float b = (noise[((y + 1) % height) * width + (x)] + 1.0f) * 0.5f; //bottom center
-            float br = (noise[((y + 1) % height) * width + ((x + 1) % width)] + 1.0f) * 0.5f; //bottom right
-
-            float dX = -((tr + 2.0f * r + br) - (tl + 2.0f * l + bl));
-            float dY = -((bl + 2.0f * b + br) - (tl + 2.0f * t + tr));
-
-            float dZ = 1.0f / strength;
-            float len = sqrtf(dX * dX + dY * dY + dZ * dZ);
-            dX /= len;
-            dY /= len;
-
-            int index = (y * width + x) * 4;
-            normal[index + 0] = (unsigned char)((dX * 0.5f + 0.5f) * 255.f);
-            normal[index + 1] = (unsigned char)((dY * 0.5f + 0.5f) * 255.f);
-            normal[index + 2] = 255;
-            normal[index + 3] = 255;
+            return cache->Store(key, material, stats);
+        }));
+}
+
+void planet::Planet::SetNoiseCacheBudget(const size_t bytes)
+{
+    noiseCacheBudget = bytes;
+    TrimNoiseCache();
+}
+
+void planet::Planet::SetNoiseField(const Layer layer, std::vector<float>&& noise)
+{
+    Texture* texture = layer == Layer::Terrain ? static_cast<Texture*>(terrain) : static_cast<Texture*>(clouds);
+    NoiseField& field = layer == Layer::Terrain ? terrainNoise : cloudNoise;
+    field.data = std::move(noise);
+    StampNoiseField(texture, field);
+}
+
+bool planet::Planet::IsNoiseCurrent(Texture* texture, const NoiseField& field) const
+{
+    const std::string preset = std::string(typeid(*texture).name()) + ":" + texture->GetGeneratorKey();
+    return field.preset == preset && field.seed == texture->seed && field.resolution == texture->resolution &&
+        field.layout == texture->layout && field.radius == texture->radius && field.offset == config->offset;
+}
+
+planet::Planet::NoiseLayout planet::Planet::GetNoiseLayout(const Texture* texture)
+{
+    NoiseLayout layout;
+    layout.width = texture->GetSampleResolution();
+    layout.height = layout.width;
+    if (texture->layout == TextureLayout::Cubemap)
+    {
+        // Faces are stored with their apron, which stands in for the wrap around of the equirectangular layout
+        layout.faces = 6;
+        layout.stride = layout.width + 2;
+        layout.wrap = false;
+    }
+    else
+    {
+        layout.stride = layout.width;
+    }
+
+    return layout;
+}
+
+const float* planet::Planet::NoiseLayout::GetRow(const std::vector<float>& noise, const int face, const int y) const
+{
+    // Equirectangular rows past the poles wrap to the opposite pole row
+    if (wrap)
+    {
+        const int row = y < 0 ? height - 1 : y >= height ? 0 : y;
+        return &noise[static_cast<size_t>(row) * stride];
+    }
+
+    // Skip the apron row and column, so row -1 and column -1 land on the apron
+    const size_t faceOffset = static_cast<size_t>(face) * stride * (height + 2);
+    return &noise[faceOffset + static_cast<size_t>(y + 1) * stride + 1];
+}
+
+float planet::Planet::NoiseLayout::Sample(const std::vector<float>& noise, const glm::vec2 uv) const
+{
+    const auto bilinear = [&](const int face, const float x, const float y, const auto& column)
+    {
+        const int x0 = (int)std::floor(x);
+        const int y0 = (int)std::floor(y);
+        const float tx = x - (float)x0;
+        const float ty = y - (float)y0;
+        const float* top = GetRow(noise, face, y0);
+        const float* bottom = GetRow(noise, face, y0 + 1);
+        const float upper = top[column(x0)] + (top[column(x0 + 1)] - top[column(x0)]) * tx;
+        const float lower = bottom[column(x0)] + (bottom[column(x0 + 1)] - bottom[column(x0)]) * tx;
+        return upper + (lower - upper) * ty;
+    };
+
+    // Texel x of the equirectangular noise sits at u = x / width, columns wrap and rows stop at the poles
+    if (wrap)
+    {
+        const float y = glm::clamp(uv.y * (float)height, 0.0f, (float)(height - 1) - 1e-3f);
+        return bilinear(0, uv.x * (float)width, y, [this](const int x) { return (x % width + width) % width; });
+    }
+
+    // The direction the equirectangular noise would have sampled at this coordinate, see Sphere::GetTileCoordinates
+    const float theta = (2.0f * uv.x - 1.0f) * glm::pi<float>();
+    const float phi = (1.0f - 2.0f * uv.y) * glm::half_pi<float>();
+    const glm::vec3 point(cosf(phi) * cosf(theta), cosf(phi) * sinf(theta), sinf(phi));
+
+    // Back into the cubemap face orientation, see Sphere::CalculateCubemapCoordinates
+    const glm::vec3 direction(-point.x, point.z, -point.y);
+    const glm::vec3 magnitude(std::abs(direction.x), std::abs(direction.y), std::abs(direction.z));
+    int face;
+    float s, t;
+    if (magnitude.x >= magnitude.y && magnitude.x >= magnitude.z)
+    {
+        face = direction.x > 0.0f ? 0 : 1;
+        s = (direction.x > 0.0f ? -direction.z : direction.z) / magnitude.x;
+        t = -direction.y / magnitude.x;
+    }
+    else if (magnitude.y >= magnitude.z)
+    {
+        face = direction.y > 0.0f ? 2 : 3;
+        s = direction.x / magnitude.y;
+        t = (direction.y > 0.0f ? direction.z : -direction.z) / magnitude.y;
+    }
+    else
+    {
+        face = direction.z > 0.0f ? 4 : 5;
+        s = (direction.z > 0.0f ? direction.x : -direction.x) / magnitude.z;
+        t = -direction.y / magnitude.z;
+    }
+
+    // Texel centers, the apron covers the half texel past the border of the face
+    const float x = (s + 1.0f) * 0.5f * (float)width - 0.5f;
+    const float y = (t + 1.0f) * 0.5f * (float)height - 0.5f;
+    return bilinear(face, x, y, [](const int column) { return column; });
+}
+
+const std::vector<float>& planet::Planet::GetNoiseField(Texture* texture, NoiseField& field)
+{
+    // Fields dropped by the memory budget are regenerated on demand
+    if (IsNoiseCurrent(texture, field) && !field.data.empty())
+    {
+        return field.data;
+    }
+
+    PLANET_PROFILE_SCOPE_BYTES(texture == terrain ? "Terrain/Noise" : "Clouds/Noise", texture->GetSampleCount() * sizeof(float));
+    field.data = texture->GetNoiseData(config->offset);
+    StampNoiseField(texture, field);
+
+    return field.data;
+}
+
+void planet::Planet::StampNoiseField(Texture* texture, NoiseField& field)
+{
+    field.preset = std::string(typeid(*texture).name()) + ":" + texture->GetGeneratorKey();
+    field.seed = texture->seed;
+    field.resolution = texture->resolution;
+    field.layout = texture->layout;
+    field.radius = texture->radius;
+    field.offset = config->offset;
+}
+
+std::vector<float> planet::Planet::GetHeightNoise() const
+{
+    const NoiseLayout layout = GetNoiseLayout(terrain);
+    const size_t texels = static_cast<size_t>(layout.width) * layout.height * layout.faces;
+    if (terrainMaterial.height.size() != texels || terrainMaterial.layout != terrain->layout)
+    {
+        return {};
+    }
+
+    // Equirectangular noise has no apron, every face of a cubemap has one row and column on either side
+    const int apron = layout.wrap ? 0 : 1;
+    const int rows = layout.height + 2 * apron;
+    std::vector<float> noise(static_cast<size_t>(layout.stride) * rows * layout.faces);
+    for (int face = 0; face < layout.faces; face++)
+    {
+        const uint16_t* source = terrainMaterial.height.data() + static_cast<size_t>(face) * layout.width * layout.height;
+        float* output = noise.data() + static_cast<size_t>(face) * layout.stride * rows;
+        for (int y = 0; y < rows; y++)
+        {
+            const int row = std::clamp(y - apron, 0, layout.height - 1);
+            for (int x = 0; x < layout.stride; x++)
+            {
+                const int column = std::clamp(x - apron, 0, layout.width - 1);
+                const float height = (float)source[static_cast<size_t>(row) * layout.width + column] / 65535.f;
+                output[static_cast<size_t>(y) * layout.stride + x] = height * 2.0f - 1.0f;
+            }
         }
     }
-    cloudMaterial.normal = normal;
 
-    // TODO: Emissive
-    // TODO: Normal
-    // TODO: Occlusion
+    return noise;
+}
+
+planet::HeightfieldStats planet::Planet::CalculateStats(const std::vector<float>& noise)
+{
+    if (noise.empty())
+    {
+        return {};
+    }
+
+    PLANET_PROFILE_SCOPE("Stats");
+    float min = noise[0];
+    float max = noise[0];
+    #pragma omp parallel for reduction(min : min) reduction(max : max)
+    for (size_t i = 0; i < noise.size(); i++)
+    {
+        min = std::min(min, noise[i]);
+        max = std::max(max, noise[i]);
+    }
+
+    return {min, max};
+}
+
+void planet::Planet::TrimNoiseCache()
+{
+    for (NoiseField* field : {&cloudNoise, &terrainNoise})
+    {
+        if (terrainNoise.GetBytes() + cloudNoise.GetBytes() <= noiseCacheBudget)
+        {
+            return;
+        }
+
+        *field = NoiseField{};
+    }
 }
 
 glm::vec3 planet::Planet::LerpColor(glm::vec3 a, glm::vec3 b, float t)
 {
-    return {
-            bee::Lerp(a.r, b.r, t),
-            bee::Lerp(a.g, b.g, t),
-            bee::Lerp(a.b, b.b, t),
-        };
+    return a + t * (b - a);
 }
 
 glm::vec3 planet::Planet::GetColorByHeight(float height)
 {
     if (terrainColorPalette.empty())
     {
-        const auto color = static_cast<unsigned char>(255.f * height);
-        return glm::vec3(color);
+        return glm::vec3(height);
     }
 
     for (size_t i = 0; i < terrainColorPalette.size() - 1; i++)
@@ -322,3 +1203,19 @@ glm::vec3 planet::Planet::GetCloudColorByHeight(float height)
 
     return newColor;
 }
+
+void planet::Planet::BakeTerrainColors()
+{
+    PLANET_PROFILE_SCOPE("Palette/Bake");
+    terrainColorLUT.min = 0.0f;
+    terrainColorLUT.max = 1.0f;
+    terrainColorLUT.Bake([this](const float height) { return GetColorByHeight(height); });
+}
+
+void planet::Planet::BakeCloudColors()
+{
+    // The color variation saturates once the offset reaches a full channel, which happens 1.25 away from the mid-point
+    cloudColorLUT.min = -0.75f;
+    cloudColorLUT.max = 1.75f;
+    cloudColorLUT.Bake([this](const float height) { return GetCloudColorByHeight(height); });
+}
@@ -0,0 +1,112 @@
+﻿#include "planetgen/lib/Profiler.h"
+
+#ifdef PLANETGEN_PROFILING
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include "omp.h"
+
+std::mutex planet::Profiler::mutex{};
+std::vector<planet::ProfileEvent> planet::Profiler::events{};
+std::vector<planet::ProfileStats> planet::Profiler::stats{};
+
+namespace
+{
+const auto PROFILER_START = std::chrono::steady_clock::now();
+
+// Small sequential ids read better in a trace than hashed thread ids
+uint32_t GetThreadIndex()
+{
+    static std::atomic<uint32_t> nextIndex{0};
+    thread_local const uint32_t index = nextIndex++;
+    return index;
+}
+}
+
+int64_t planet::Profiler::GetMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - PROFILER_START).count();
+}
+
+void planet::Profiler::Record(const ProfileEvent& event)
+{
+    std::lock_guard lock(mutex);
+    if (events.size() < maxEvents)
+    {
+        events.push_back(event);
+    }
+
+    auto iter = std::lower_bound(stats.begin(), stats.end(), event.name,
+                                 [](const ProfileStats& entry, const char* name) { return entry.name < name; });
+    if (iter == stats.end() || iter->name != event.name)
+    {
+        iter = stats.insert(iter, ProfileStats{event.name});
+    }
+
+    iter->calls++;
+    iter->lastMs = (double)event.duration / 1000.0;
+    iter->totalMs += iter->lastMs;
+    iter->threads = event.threads;
+    iter->lastBytes = event.bytes;
+}
+
+std::vector<planet::ProfileStats> planet::Profiler::GetStats()
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void planet::Profiler::Clear()
+{
+    std::lock_guard lock(mutex);
+    events.clear();
+    stats.clear();
+}
+
+bool planet::Profiler::WriteChromeTrace(const std::string& path)
+{
+    std::vector<ProfileEvent> trace;
+    {
+        std::lock_guard lock(mutex);
+        trace = events;
+    }
+
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        const auto& event = trace[i];
+        std::fprintf(file,
+                     "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"threads\":%d,\"bytes\":%zu}}%s\n",
+                     event.name, (long long)event.start, (long long)event.duration, event.thread, event.threads,
+                     event.bytes, i + 1 < trace.size() ? "," : "");
+    }
+    std::fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    return std::fclose(file) == 0;
+}
+
+planet::ProfileScope::ProfileScope(const char* name, const size_t bytes)
+{
+    event.name = name;
+    event.bytes = bytes;
+    event.thread = GetThreadIndex();
+    event.threads = omp_in_parallel() ? 1 : omp_get_max_threads();
+    event.start = Profiler::GetMicroseconds();
+}
+
+planet::ProfileScope::~ProfileScope()
+{
+    event.duration = Profiler::GetMicroseconds() - event.start;
+    Profiler::Record(event);
+}
+
+#endif
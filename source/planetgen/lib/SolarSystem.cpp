@@ -0,0 +1,199 @@
+﻿#include "planetgen/lib/SolarSystem.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "planetgen/lib/MaterialCache.h"
+#include "planetgen/lib/Profiler.h"
+
+namespace
+{
+// Samples per noise task, small enough that even a 1024 layer spreads over a few dozen workers
+constexpr size_t BAND_SAMPLES = 64 * 1024;
+}
+
+struct planet::SolarSystem::LayerNoise
+{
+    Layer layer = Layer::Terrain;
+    Texture* texture = nullptr;
+    SharedSphericalCoordinates coords{};
+    std::vector<float> data{};
+    std::vector<FastNoise::OutputMinMax> ranges{};  // Raw range of every band
+    std::atomic<size_t> bandsLeft{0};
+};
+
+struct planet::SolarSystem::Job
+{
+    size_t index = 0;
+    SystemPlanet* planet = nullptr;
+    LayerNoise layers[2];
+    std::atomic<int> layersLeft{0};
+};
+
+planet::SolarSystem::SolarSystem(PlanetFactory& factory, MaterialCache* cache) : factory(factory), cache(cache)
+{
+}
+
+bool planet::SolarSystem::Add(const PlanetRecipe& recipe)
+{
+    auto entry = std::make_unique<SystemPlanet>();
+    entry->recipe = recipe;
+    entry->terrain.reset(factory.instantiateTerrain(recipe.terrain));
+    entry->clouds.reset(factory.instantiateClouds(recipe.clouds));
+    if (entry->terrain == nullptr || entry->clouds == nullptr)
+    {
+        return false;
+    }
+
+    for (Texture* texture : {static_cast<Texture*>(entry->terrain.get()), static_cast<Texture*>(entry->clouds.get())})
+    {
+        texture->SetSeed(recipe.seed);
+        texture->SetTextureResolution(recipe.resolution);
+        texture->SetLayout(recipe.layout);
+    }
+    entry->config = std::make_unique<MeshConfig>(recipe.mesh);
+
+    planets.push_back(std::move(entry));
+    return true;
+}
+
+void planet::SolarSystem::Generate(WorkStealingPool& pool, const ReadyCallback& onReady)
+{
+    std::vector<std::shared_ptr<Job>> jobs;
+    for (size_t i = 0; i < planets.size(); i++)
+    {
+        if (planets[i]->planet == nullptr)
+        {
+            auto job = std::make_shared<Job>();
+            job->index = i;
+            job->planet = planets[i].get();
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    // Workers run their own queue newest first and steal the oldest tasks of the others. Submitted smallest to
+    // largest, every worker starts on the biggest planet it got, and the small ones are left for idle workers to steal.
+    const auto getSamples = [](const Job& job)
+    {
+        return job.planet->terrain->GetSampleCount() + job.planet->clouds->GetSampleCount();
+    };
+    std::stable_sort(jobs.begin(), jobs.end(), [&](const auto& a, const auto& b) { return getSamples(*a) < getSamples(*b); });
+
+    for (const auto& job : jobs)
+    {
+        pool.Submit([this, &pool, job, &onReady]() { Start(pool, job, onReady); });
+    }
+    pool.Wait();
+}
+
+void planet::SolarSystem::Start(WorkStealingPool& pool, const std::shared_ptr<Job>& job, const ReadyCallback& onReady) const
+{
+    if (IsCancelled())
+    {
+        return;
+    }
+
+    PLANET_PROFILE_SCOPE("System/Start");
+    SystemPlanet& entry = *job->planet;
+    entry.planet = std::make_unique<Planet>(entry.terrain.get(), entry.clouds.get(), entry.config.get(), cache, false);
+    entry.planet->SetCancelFlag(cancelFlag);
+    entry.planet->SetParallelFor([&pool](const int count, const std::function<void(int)>& body)
+    {
+        pool.ParallelFor(count, body);
+    });
+
+    Texture* textures[] = {entry.terrain.get(), entry.clouds.get()};
+    for (int i = 0; i < 2; i++)
+    {
+        LayerNoise& noise = job->layers[i];
+        noise.layer = i == 0 ? Layer::Terrain : Layer::Clouds;
+        noise.texture = textures[i];
+        if (!noise.texture->HasNoise())
+        {
+            continue;
+        }
+
+        // The offset can change the graph, and the graph is built lazily, so both happen before the bands share it
+        noise.texture->PrepareNoise(entry.config->offset);
+        noise.texture->GetGeneratorKey();
+        if (cache != nullptr && cache->Contains(entry.planet->GetMaterialKey(noise.layer)))
+        {
+            continue;
+        }
+
+        const size_t samples = noise.texture->GetSampleCount();
+        noise.coords = Sphere::GetSphericalCoordinates(noise.texture->GetSampleResolution(), noise.texture->GetLayout());
+        noise.data.resize(samples);
+        noise.ranges.resize((samples + BAND_SAMPLES - 1) / BAND_SAMPLES);
+        noise.bandsLeft = noise.ranges.size();
+        job->layersLeft++;
+    }
+
+    if (job->layersLeft == 0)
+    {
+        Shade(*job, onReady);
+        return;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        for (size_t band = 0; band < job->layers[i].ranges.size(); band++)
+        {
+            pool.Submit([this, job, i, band, &onReady]() { GenerateBand(job, i, band, onReady); });
+        }
+    }
+}
+
+void planet::SolarSystem::GenerateBand(const std::shared_ptr<Job>& job, const int layer, const size_t band,
+                                       const ReadyCallback& onReady) const
+{
+    if (IsCancelled())
+    {
+        return;
+    }
+
+    LayerNoise& noise = job->layers[layer];
+    const size_t begin = band * BAND_SAMPLES;
+    const size_t count = std::min(BAND_SAMPLES, noise.data.size() - begin);
+    noise.ranges[band] = noise.texture->GenerateOnPoints(*noise.coords, begin, count, noise.data.data() + begin);
+    if (--noise.bandsLeft > 0)
+    {
+        return;
+    }
+
+    // Normalized over the range of the whole sphere, exactly like Texture::GetNoiseData()
+    FastNoise::OutputMinMax range;
+    for (const auto& bandRange : noise.ranges)
+    {
+        range << bandRange;
+    }
+    noise.texture->NormalizeNoise(noise.data.data(), noise.data.size(), range);
+    noise.coords.reset();
+    job->planet->planet->SetNoiseField(noise.layer, std::move(noise.data));
+
+    if (--job->layersLeft == 0)
+    {
+        Shade(*job, onReady);
+    }
+}
+
+void planet::SolarSystem::Shade(Job& job, const ReadyCallback& onReady) const
+{
+    PLANET_PROFILE_SCOPE("System/Shade");
+    Planet& planet = *job.planet->planet;
+    planet.RebuildTerrain();
+    planet.RebuildClouds();
+
+    // The planet outlives the pool and the flag, later rebuilds go back to OpenMP
+    planet.SetParallelFor({});
+    planet.SetCancelFlag(nullptr);
+    if (IsCancelled())
+    {
+        return;
+    }
+
+    if (onReady)
+    {
+        onReady(job.index, *job.planet);
+    }
+}
@@ -1,8 +1,24 @@
 ﻿#include "planetgen/lib/Sphere.h"
 
-#include "tools/log.hpp"
+#include <algorithm>
+#include <numeric>
 
-std::unordered_map<int, planet::SphericalCoordinates> planet::Sphere::coords{};
+#include "planetgen/lib/Profiler.h"
+
+std::list<planet::Sphere::CacheEntry> planet::Sphere::coords{};
+std::mutex planet::Sphere::coordsMutex{};
+size_t planet::Sphere::coordsBudget = 512ull * 1024 * 1024;
+
+planet::Mesh planet::Sphere::Create(const MeshConfig& config, const float radiusOffset)
+{
+    PLANET_PROFILE_SCOPE("Sphere/Mesh");
+    if (config.type == MeshType::Cube)
+    {
+        return Cube(config.radius + radiusOffset, config.subdivisions, config.inverted);
+    }
+
+    return UV(config.radius + radiusOffset, config.stacks, config.sectors, config.inverted);
+}
 
 planet::Mesh planet::Sphere::UV(const float radius, const int stacks, const int sectors, const bool inverted)
 {
@@ -39,8 +55,8 @@ planet::Mesh planet::Sphere::UV(const float radius, const int stacks, const int
     // Generate indices
     for (int i = 0; i < stacks; ++i)
     {
-        short k1 = (short)(i * (sectors + 1));     // Beginning of current stack
-        short k2 = (short)(k1 + sectors + 1);      // Beginning of next stack
+        uint32_t k1 = (uint32_t)(i * (sectors + 1));    // Beginning of current stack
+        uint32_t k2 = k1 + (uint32_t)sectors + 1;       // Beginning of next stack
 
         for (int j = 0; j < sectors; ++j, ++k1, ++k2)
         {
@@ -82,53 +98,460 @@ planet::Mesh planet::Sphere::UV(const float radius, const int stacks, const int
     return mesh;
 }
 
-planet::SphericalCoordinates planet::Sphere::GetSphericalCoordinates(const float radius, const int resolution, const glm::vec3 offset)
+namespace
+{
+// Face normal, followed by the two axes spanning the face. u x v equals the normal, so quads wound
+// counter-clockwise in (u, v) face outwards.
+const glm::vec3 CUBE_FACES[6][3] = {
+    {{ 1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
+    {{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+    {{ 0, 1, 0}, {0, 0, 1}, {1, 0, 0}},
+    {{ 0,-1, 0}, {1, 0, 0}, {0, 0, 1}},
+    {{ 0, 0, 1}, {1, 0, 0}, {0, 1, 0}},
+    {{ 0, 0,-1}, {0, 1, 0}, {1, 0, 0}},
+};
+}
+
+glm::vec3 planet::Sphere::GetCubePoint(const int face, const float s, const float t)
+{
+    return CUBE_FACES[face][0] + CUBE_FACES[face][1] * s + CUBE_FACES[face][2] * t;
+}
+
+int planet::Sphere::GetCubeFace(const glm::vec3 point, float& s, float& t)
 {
-    const auto it = coords.find(resolution);
-    if (it != coords.end())
+    int face = 0;
+    float major = -1.0f;
+    for (int i = 0; i < 6; i++)
+    {
+        const float distance = glm::dot(point, CUBE_FACES[i][0]);
+        if (distance > major)
+        {
+            face = i;
+            major = distance;
+        }
+    }
+
+    s = glm::dot(point, CUBE_FACES[face][1]) / major;
+    t = glm::dot(point, CUBE_FACES[face][2]) / major;
+    return face;
+}
+
+glm::vec3 planet::Sphere::Spherify(const glm::vec3 p)
+{
+    // Spreads the points far more evenly than normalizing
+    const float x2 = p.x * p.x;
+    const float y2 = p.y * p.y;
+    const float z2 = p.z * p.z;
+    return {
+        p.x * sqrtf(1.0f - y2 * 0.5f - z2 * 0.5f + y2 * z2 / 3.0f),
+        p.y * sqrtf(1.0f - z2 * 0.5f - x2 * 0.5f + z2 * x2 / 3.0f),
+        p.z * sqrtf(1.0f - x2 * 0.5f - y2 * 0.5f + x2 * y2 / 3.0f),
+    };
+}
+
+planet::Mesh planet::Sphere::Cube(const float radius, int subdivisions, const bool inverted)
+{
+    Mesh mesh{};
+    subdivisions = std::max(subdivisions, 1);
+
+    const float PI = glm::pi<float>();
+    const int verticesPerEdge = subdivisions + 1;
+    const size_t verticesPerFace = (size_t)verticesPerEdge * verticesPerEdge;
+
+    mesh.positions.resize(verticesPerFace * 6);
+    mesh.normals.resize(verticesPerFace * 6);
+    mesh.uvs.resize(verticesPerFace * 6);
+
+    #pragma omp parallel for collapse(2)
+    for (int face = 0; face < 6; face++)
+    {
+        for (int i = 0; i < verticesPerEdge; i++)
+        {
+            const float s = 2.0f * (float)i / (float)subdivisions - 1.0f;
+
+            for (int j = 0; j < verticesPerEdge; j++)
+            {
+                const float t = 2.0f * (float)j / (float)subdivisions - 1.0f;
+                const glm::vec3 n = Spherify(GetCubePoint(face, s, t));
+
+                // Same equirectangular mapping as the UV sphere, so both meshes share their textures
+                float u = atan2f(n.z, n.x) / (2.0f * PI);
+                if (u < 0.0f) u += 1.0f;
+                const float v = acosf(glm::clamp(n.y, -1.0f, 1.0f)) / PI;
+
+                const size_t index = face * verticesPerFace + (size_t)i * verticesPerEdge + j;
+                mesh.positions[index] = n * radius;
+                mesh.normals[index] = glm::normalize(n);
+                mesh.uvs[index] = {u, v};
+            }
+        }
+    }
+
+    // Generate indices
+    mesh.indices.reserve((size_t)subdivisions * subdivisions * 6 * 6);
+    for (int face = 0; face < 6; face++)
+    {
+        const uint32_t base = (uint32_t)(face * verticesPerFace);
+        for (int i = 0; i < subdivisions; i++)
+        {
+            for (int j = 0; j < subdivisions; j++)
+            {
+                const uint32_t k00 = base + (uint32_t)(i * verticesPerEdge + j);
+                const uint32_t k10 = k00 + (uint32_t)verticesPerEdge;   // One step along u
+                const uint32_t k01 = k00 + 1;                           // One step along v
+                const uint32_t k11 = k10 + 1;
+
+                const uint32_t quad[6] = {k00, k10, k11, k00, k11, k01};
+                for (int k = 0; k < 6; k += 3)
+                {
+                    mesh.indices.push_back(quad[k]);
+                    mesh.indices.push_back(inverted ? quad[k + 2] : quad[k + 1]);
+                    mesh.indices.push_back(inverted ? quad[k + 1] : quad[k + 2]);
+                }
+            }
+        }
+    }
+
+    // Triangles crossing the texture seam or touching a pole would interpolate across the whole texture,
+    // give them their own copy of the offending vertices instead.
+    const size_t triangleCount = mesh.indices.size() / 3;
+    for (size_t triangle = 0; triangle < triangleCount; triangle++)
     {
-        auto v =  it->second;
-        #pragma omp parallel for
-        for (size_t i = 0; i < v.x.size(); i++)
+        uint32_t* corners = &mesh.indices[triangle * 3];
+        float uMin = 1.0f, uMax = 0.0f;
+        for (int k = 0; k < 3; k++)
         {
-            v.x[i] *= radius + offset.x;
-            v.y[i] *= radius + offset.y;
-            v.z[i] *= radius + offset.z;
+            uMin = std::min(uMin, mesh.uvs[corners[k]].x);
+            uMax = std::max(uMax, mesh.uvs[corners[k]].x);
+        }
+        const bool crossesSeam = uMax - uMin > 0.5f;
+
+        float uSum = 0.0f;
+        int uCount = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            const glm::vec3& n = mesh.normals[corners[k]];
+            if (std::abs(n.x) < 1e-6f && std::abs(n.z) < 1e-6f) continue;
+
+            uSum += crossesSeam && mesh.uvs[corners[k]].x < 0.5f ? mesh.uvs[corners[k]].x + 1.0f : mesh.uvs[corners[k]].x;
+            uCount++;
         }
 
-        return v;
+        for (int k = 0; k < 3; k++)
+        {
+            glm::vec2 uv = mesh.uvs[corners[k]];
+            const glm::vec3& n = mesh.normals[corners[k]];
+            if (std::abs(n.x) < 1e-6f && std::abs(n.z) < 1e-6f)
+            {
+                uv.x = uCount > 0 ? uSum / (float)uCount : 0.5f;
+            }
+            else if (crossesSeam && uv.x < 0.5f)
+            {
+                uv.x += 1.0f;
+            }
+            else
+            {
+                continue;
+            }
+
+            mesh.positions.push_back(mesh.positions[corners[k]]);
+            mesh.normals.push_back(mesh.normals[corners[k]]);
+            mesh.uvs.push_back(uv);
+            corners[k] = (uint32_t)(mesh.positions.size() - 1);
+        }
     }
 
-    CalculateSphericalCoordinates(resolution);
-    return GetSphericalCoordinates(radius, resolution, offset);
+    return mesh;
 }
 
-void planet::Sphere::CalculateSphericalCoordinates(int resolution)
+std::vector<uint32_t> planet::Sphere::GetSharedVertices(const Mesh& mesh)
 {
-    SphericalCoordinates output(resolution * resolution);
+    PLANET_PROFILE_SCOPE("Sphere/SharedVertices");
+    float extent = 0.0f;
+    for (const glm::vec3& position : mesh.positions)
+    {
+        extent = std::max({extent, std::abs(position.x), std::abs(position.y), std::abs(position.z)});
+    }
+
+    // Copies differ by float rounding at most, distinct vertices of the densest tessellation are far further apart.
+    // Sorted along x, only the vertices within the tolerance of each other along x have to be compared.
+    const float tolerance = std::max(extent, 1e-6f) * 1e-5f;
+    const uint32_t vertexCount = (uint32_t)mesh.positions.size();
+    std::vector<uint32_t> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](const uint32_t a, const uint32_t b) { return mesh.positions[a].x < mesh.positions[b].x; });
 
-#pragma omp parallel for
-    for (int y = 0; y < resolution; y++)
+    // Groups of copies as a union-find forest rooted at their lowest index
+    std::vector<uint32_t> shared(vertexCount);
+    std::iota(shared.begin(), shared.end(), 0u);
+    const auto find = [&shared](uint32_t vertex)
     {
-        for (int x = 0; x < resolution; x++)
+        while (shared[vertex] != vertex)
         {
+            vertex = shared[vertex];
+        }
+        return vertex;
+    };
+
+    for (uint32_t i = 0; i < vertexCount; i++)
+    {
+        const glm::vec3& position = mesh.positions[order[i]];
+        for (uint32_t j = i + 1; j < vertexCount && mesh.positions[order[j]].x - position.x <= tolerance; j++)
+        {
+            if (glm::distance(mesh.positions[order[j]], position) <= tolerance)
+            {
+                const uint32_t a = find(order[i]);
+                const uint32_t b = find(order[j]);
+                shared[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        shared[vertex] = shared[shared[vertex]];
+    }
+
+    return shared;
+}
+
+void planet::Sphere::CalculateNormals(Mesh& mesh, const std::vector<uint32_t>& shared)
+{
+    PLANET_PROFILE_SCOPE("Sphere/Normals");
+    const size_t vertexCount = mesh.positions.size();
+    const size_t triangleCount = mesh.indices.size() / 3;
+
+    // The cross product is twice the area of the triangle, so summing them weights every triangle by its area
+    std::vector<glm::vec3> triangleNormals(triangleCount);
+    #pragma omp parallel for
+    for (size_t triangle = 0; triangle < triangleCount; triangle++)
+    {
+        const glm::vec3& a = mesh.positions[mesh.indices[triangle * 3]];
+        const glm::vec3& b = mesh.positions[mesh.indices[triangle * 3 + 1]];
+        const glm::vec3& c = mesh.positions[mesh.indices[triangle * 3 + 2]];
+        triangleNormals[triangle] = glm::cross(b - a, c - a);
+    }
+
+    // Triangles around every vertex as compressed sparse rows, so each vertex gathers its own normal without atomics
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (const uint32_t index : mesh.indices)
+    {
+        offsets[shared[index] + 1]++;
+    }
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        offsets[vertex + 1] += offsets[vertex];
+    }
+
+    std::vector<uint32_t> triangles(mesh.indices.size());
+    std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < mesh.indices.size(); i++)
+    {
+        triangles[cursors[shared[mesh.indices[i]]]++] = (uint32_t)(i / 3);
+    }
+
+    mesh.normals.resize(vertexCount);
+    #pragma omp parallel for
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        const uint32_t source = shared[vertex];
+        glm::vec3 sum(0.0f);
+        for (uint32_t i = offsets[source]; i < offsets[source + 1]; i++)
+        {
+            sum += triangleNormals[triangles[i]];
+        }
+
+        // Vertices without triangles keep pointing away from the center
+        const float length = glm::length(sum);
+        mesh.normals[vertex] = length > 0.0f ? sum / length : glm::normalize(mesh.positions[vertex]);
+    }
+}
+
+planet::SharedSphericalCoordinates planet::Sphere::GetSphericalCoordinates(const int resolution, const TextureLayout layout)
+{
+    std::promise<SharedSphericalCoordinates> promise;
+    std::shared_future<SharedSphericalCoordinates> cached;
+    {
+        std::lock_guard lock(coordsMutex);
+        const auto it = std::find_if(coords.begin(), coords.end(), [=](const CacheEntry& entry) { return entry.resolution == resolution && entry.layout == layout; });
+        if (it != coords.end())
+        {
+            coords.splice(coords.begin(), coords, it);
+            cached = it->coordinates;
+        }
+        else
+        {
+            // Claim the resolution before building it, so concurrent requests wait for this build instead of starting their own
+            CacheEntry entry{};
+            entry.resolution = resolution;
+            entry.layout = layout;
+            entry.bytes = GetSampleCount(resolution, layout) * 3 * sizeof(float);
+            entry.coordinates = promise.get_future().share();
+            coords.push_front(entry);
+        }
+    }
+
+    // Waiting for a build in progress happens outside the lock, so lookups of other entries don't queue up behind it
+    if (cached.valid())
+    {
+        return cached.get();
+    }
+
+    SharedSphericalCoordinates coordinates;
+    try
+    {
+        PLANET_PROFILE_SCOPE_BYTES("Sphere/Coordinates", GetSampleCount(resolution, layout) * 3 * sizeof(float));
+        coordinates = layout == TextureLayout::Cubemap ? CalculateCubemapCoordinates(resolution) : CalculateSphericalCoordinates(resolution);
+        promise.set_value(coordinates);
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+        std::lock_guard lock(coordsMutex);
+        coords.remove_if([=](const CacheEntry& entry) { return entry.resolution == resolution && entry.layout == layout; });
+        throw;
+    }
+
+    std::lock_guard lock(coordsMutex);
+    EvictCoordinates();
+    return coordinates;
+}
+
+size_t planet::Sphere::GetSampleCount(const int resolution, const TextureLayout layout)
+{
+    if (layout == TextureLayout::Cubemap)
+    {
+        return static_cast<size_t>(resolution + 2) * (resolution + 2) * 6;
+    }
+
+    return static_cast<size_t>(resolution) * resolution;
+}
+
+void planet::Sphere::SetCoordinateCacheBudget(const size_t bytes)
+{
+    std::lock_guard lock(coordsMutex);
+    coordsBudget = bytes;
+    EvictCoordinates();
+}
+
+void planet::Sphere::EvictCoordinates()
+{
+    size_t bytes = 0;
+    for (const auto& entry : coords)
+    {
+        bytes += entry.bytes;
+    }
+
+    // Never evict the most recently used entry, nor entries that are still being built
+    while (bytes > coordsBudget && coords.size() > 1)
+    {
+        auto victim = std::prev(coords.end());
+        while (victim != coords.begin() && victim->coordinates.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            --victim;
+        }
+        if (victim == coords.begin())
+        {
+            break;
+        }
+
+        bytes -= victim->bytes;
+        coords.erase(victim);
+    }
+}
+
+planet::SphericalCoordinates planet::Sphere::GetTileCoordinates(const int resolution, const int x0, const int y0,
+                                                                 const int width, const int height)
+{
+    SphericalCoordinates output(width * height);
+
+    // Latitude only depends on the row and longitude only on the column,
+    // so the trigonometry is done once per row and column instead of once per texel.
+    const auto angles = [resolution](const int start, const int count, std::vector<float>& cosines, std::vector<float>& sines,
+                                     const bool isLatitude)
+    {
+        cosines.resize(count);
+        sines.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            // Texels outside the texture wrap around, like the apron of a tile on the border
+            const int texel = ((start + i) % resolution + resolution) % resolution;
+
             // Map x, y to [-1, 1] range
-            const float u = 2.0f * (((float)x / (float)resolution) - 0.5f);
-            float v = 2.0f * (((float)y / (float)resolution) - 0.5f);
+            const float uv = 2.0f * (((float)texel / (float)resolution) - 0.5f);
             // Fix the pole locations issue (poles where rendered equator instead of the poles)
-            v = 1.0f - v;
-            
-            // Convert u, v to spherical coordinates
-            const float theta = u * glm::pi<float>();
-            const float phi = (v * glm::half_pi<float>()) - glm::half_pi<float>();
+            const float angle = isLatitude ? ((1.0f - uv) * glm::half_pi<float>()) - glm::half_pi<float>() : uv * glm::pi<float>();
+
+            cosines[i] = cos(angle);
+            sines[i] = sin(angle);
+        }
+    };
+
+    std::vector<float> cosPhi, sinPhi;
+    std::vector<float> cosTheta, sinTheta;
+    angles(y0, height, cosPhi, sinPhi, true);
+    angles(x0, width, cosTheta, sinTheta, false);
 
-            // Convert spherical coordinates to Cartesian coordinates
-            const int index = y * resolution + x;
-            output.x[index] = cos(phi) * cos(theta);
-            output.y[index] = cos(phi) * sin(theta);
-            output.z[index] = sin(phi);
+    #pragma omp parallel for
+    for (int y = 0; y < height; y++)
+    {
+        const size_t row = static_cast<size_t>(y) * width;
+
+        // Convert spherical coordinates to Cartesian coordinates
+        for (int x = 0; x < width; x++)
+        {
+            output.x[row + x] = cosPhi[y] * cosTheta[x];
+            output.y[row + x] = cosPhi[y] * sinTheta[x];
+            output.z[row + x] = sinPhi[y];
+        }
+    }
+
+    return output;
+}
+
+planet::SharedSphericalCoordinates planet::Sphere::CalculateSphericalCoordinates(const int resolution)
+{
+    return std::make_shared<SphericalCoordinates>(GetTileCoordinates(resolution, 0, 0, resolution, resolution));
+}
+
+planet::SharedSphericalCoordinates planet::Sphere::CalculateCubemapCoordinates(const int faceResolution)
+{
+    const int edge = faceResolution + 2;
+    const size_t faceSize = static_cast<size_t>(edge) * edge;
+    auto output = std::make_shared<SphericalCoordinates>(static_cast<int>(faceSize * 6));
+
+    #pragma omp parallel for collapse(2)
+    for (int face = 0; face < 6; face++)
+    {
+        for (int y = 0; y < edge; y++)
+        {
+            // Texel centers, the apron rows and columns land just outside [-1, 1]
+            const float t = 2.0f * ((float)(y - 1) + 0.5f) / (float)faceResolution - 1.0f;
+            for (int x = 0; x < edge; x++)
+            {
+                const float s = 2.0f * ((float)(x - 1) + 0.5f) / (float)faceResolution - 1.0f;
+
+                // Direction of the texel, following the OpenGL cubemap face orientation
+                glm::vec3 direction;
+                switch (face)
+                {
+                case 0: direction = { 1.0f,   -t,   -s}; break;
+                case 1: direction = {-1.0f,   -t,    s}; break;
+                case 2: direction = {    s, 1.0f,    t}; break;
+                case 3: direction = {    s,-1.0f,   -t}; break;
+                case 4: direction = {    s,   -t, 1.0f}; break;
+                default: direction = {  -s,   -t,-1.0f}; break;
+                }
+                direction = glm::normalize(direction);
+
+                // Rotate into the noise space of the equirectangular layout, so a preset looks the same in both layouts
+                const size_t index = face * faceSize + static_cast<size_t>(y) * edge + x;
+                output->x[index] = -direction.x;
+                output->y[index] = -direction.z;
+                output->z[index] = direction.y;
+            }
         }
     }
 
-    coords.emplace(resolution, output);
+    return output;
 }
@@ -0,0 +1,92 @@
+﻿#include "planetgen/lib/TileSink.h"
+
+#include <cstdint>
+
+#include "planetgen/lib/Material.h"
+
+namespace
+{
+constexpr std::streamoff TGA_HEADER_SIZE = 18;
+const char* MAP_NAMES[] = {"albedo", "normal", "metallicRoughness", "emissive"};
+}
+
+void planet::TgaTileSink::Begin(const int width, const int height)
+{
+    this->width = width;
+    this->height = height;
+    isGood = width <= UINT16_MAX && height <= UINT16_MAX;
+}
+
+void planet::TgaTileSink::Write(const MaterialTile& tile)
+{
+    const size_t texels = static_cast<size_t>(tile.width) * tile.height;
+    expanded.resize(texels * 4);
+
+    WriteMap(Albedo, tile.albedo, tile);
+    if (tile.normal != nullptr)
+    {
+        ExpandNormals(tile.normal, texels, expanded.data());
+        WriteMap(Normal, expanded.data(), tile);
+    }
+    if (tile.metallicRoughness != nullptr)
+    {
+        ExpandRoughness(tile.metallicRoughness, texels, expanded.data());
+        WriteMap(MetallicRoughness, expanded.data(), tile);
+    }
+    WriteMap(Emissive, tile.emissive, tile);
+}
+
+void planet::TgaTileSink::End()
+{
+    for (auto& file : files)
+    {
+        if (file.is_open())
+        {
+            file.close();
+            isGood &= !file.fail();
+        }
+    }
+}
+
+void planet::TgaTileSink::WriteMap(const Map map, const unsigned char* data, const MaterialTile& tile)
+{
+    if (data == nullptr || !isGood)
+    {
+        return;
+    }
+
+    // Files are only created for the maps the layer actually produces
+    auto& file = files[map];
+    if (!file.is_open())
+    {
+        file.open(path + "_" + MAP_NAMES[map] + ".tga", std::ios::binary | std::ios::out | std::ios::trunc);
+
+        // Uncompressed true color, 8 alpha bits and a top left origin so rows are stored top to bottom
+        const unsigned char header[TGA_HEADER_SIZE] = {
+            0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            static_cast<unsigned char>(width & 0xFF), static_cast<unsigned char>(width >> 8),
+            static_cast<unsigned char>(height & 0xFF), static_cast<unsigned char>(height >> 8),
+            32, 0x28};
+        file.write(reinterpret_cast<const char*>(header), TGA_HEADER_SIZE);
+    }
+
+    row.resize(static_cast<size_t>(tile.width) * 4);
+    for (int y = 0; y < tile.height; y++)
+    {
+        // TGA stores BGRA
+        const unsigned char* source = data + static_cast<size_t>(y) * tile.width * 4;
+        for (int x = 0; x < tile.width; x++)
+        {
+            row[x * 4 + 0] = source[x * 4 + 2];
+            row[x * 4 + 1] = source[x * 4 + 1];
+            row[x * 4 + 2] = source[x * 4 + 0];
+            row[x * 4 + 3] = source[x * 4 + 3];
+        }
+
+        const std::streamoff offset = TGA_HEADER_SIZE + (static_cast<std::streamoff>(tile.y + y) * width + tile.x) * 4;
+        file.seekp(offset);
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+
+    isGood &= !file.fail();
+}
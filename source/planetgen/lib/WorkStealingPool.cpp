@@ -0,0 +1,163 @@
+﻿#include "planetgen/lib/WorkStealingPool.h"
+
+#include <algorithm>
+
+#include "omp.h"
+
+namespace
+{
+// Pool and queue of the worker running on this thread, so tasks submit onto their own queue
+thread_local const planet::WorkStealingPool* currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+}
+
+planet::WorkStealingPool::WorkStealingPool(const int threads)
+{
+    const int count = threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < count; i++)
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (int i = 0; i < count; i++)
+    {
+        workers.emplace_back([this, i]() { Work((size_t)i); });
+    }
+}
+
+planet::WorkStealingPool::~WorkStealingPool()
+{
+    Wait();
+    {
+        std::lock_guard lock(mutex);
+        isStopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void planet::WorkStealingPool::Submit(Task task)
+{
+    const size_t index = currentPool == this ? currentQueue : nextQueue++ % queues.size();
+    pending++;
+    {
+        std::lock_guard lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    queued++;
+
+    // Taking the lock orders this with a worker checking `queued` right before it sleeps
+    {
+        std::lock_guard lock(mutex);
+    }
+    wake.notify_one();
+}
+
+void planet::WorkStealingPool::ParallelFor(const int count, const std::function<void(int)>& body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // Index 0 runs right here, the rest go onto this worker's queue where nobody but thieves gets them before us
+    std::atomic<int> left{count - 1};
+    for (int i = 1; i < count; i++)
+    {
+        Submit([&body, &left, i]()
+        {
+            body(i);
+            left--;
+        });
+    }
+    body(0);
+
+    const size_t index = currentPool == this ? currentQueue : 0;
+    while (left > 0)
+    {
+        Task task;
+        if (TakeTask(index, task))
+        {
+            RunTask(task);
+        }
+        else
+        {
+            // The remaining indices are running on other workers
+            std::this_thread::yield();
+        }
+    }
+}
+
+void planet::WorkStealingPool::Wait()
+{
+    std::unique_lock lock(mutex);
+    done.wait(lock, [this]() { return pending == 0; });
+}
+
+bool planet::WorkStealingPool::TakeTask(const size_t index, Task& task)
+{
+    {
+        Queue& own = *queues[index];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        Queue& other = *queues[(index + i) % queues.size()];
+        std::lock_guard lock(other.mutex);
+        if (!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void planet::WorkStealingPool::RunTask(Task& task)
+{
+    task();
+    task = nullptr;
+    if (--pending == 0)
+    {
+        std::lock_guard lock(mutex);
+        done.notify_all();
+    }
+}
+
+void planet::WorkStealingPool::Work(const size_t index)
+{
+    // Parallel loops inside tasks would start a team per worker on top of the pool's own threads
+    omp_set_num_threads(1);
+    currentPool = this;
+    currentQueue = index;
+
+    while (true)
+    {
+        Task task;
+        if (TakeTask(index, task))
+        {
+            RunTask(task);
+            continue;
+        }
+
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [this]() { return isStopping || queued > 0; });
+        if (isStopping)
+        {
+            return;
+        }
+    }
+}